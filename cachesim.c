@@ -0,0 +1,212 @@
+/*
+ * cachesim.c - the LRU set-associative cache model behind cachesim.h
+ *
+ * Each level keeps a tag and a last-use time per way.  A tag is a line
+ * number plus one, so that 0 marks an empty way.  Lookups scan the ways
+ * of a set, which is quick enough for the handful of ways real caches
+ * have.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cachesim.h"
+
+#define L1_DEFAULT    "32K:8"
+#define L2_DEFAULT    "1M:16"
+#define LINE_DEFAULT  "64"
+
+/* One level of the cache */
+struct cachesim_level {
+    int ways;
+    uint64_t set_mask;    /* sets - 1 */
+    uint64_t *tags;       /* sets * ways line numbers plus one, or 0 */
+    uint64_t *used;       /* the time of each way's last hit or fill */
+};
+
+int cachesim_on = 0;
+
+static struct cachesim_config config;
+static struct cachesim_level l1, l2;
+static struct cachesim_stats counts;
+static uintptr_t base_addr;   /* address of line 0 */
+static int line_shift;        /* log2(config.line) */
+static uint64_t clock_now;    /* accesses so far, for LRU */
+
+/*
+ * parse_bytes - parse the byte count at "s", with an optional K, M or G
+ *     suffix, storing where it ends in "end".  Returns 0 if there is none.
+ */
+static size_t parse_bytes(const char *s, char **end)
+{
+    unsigned long long bytes;
+
+    errno = 0;
+    bytes = strtoull(s, end, 10);
+    if (errno != 0 || *end == s)
+	return 0;
+    switch (**end) {
+    case 'G': case 'g':
+	bytes <<= 10;
+	/* fall through */
+    case 'M': case 'm':
+	bytes <<= 10;
+	/* fall through */
+    case 'K': case 'k':
+	bytes <<= 10;
+	(*end)++;
+	break;
+    }
+    return (size_t)bytes;
+}
+
+/*
+ * bad_spec - report the bad value "spec" of the variable "name" and exit
+ */
+static void bad_spec(const char *name, const char *spec, const char *why)
+{
+    fprintf(stderr, "cachesim: bad %s value \"%s\": %s\n", name, spec, why);
+    exit(1);
+}
+
+/*
+ * configure_level - set up "level" as "size" bytes in "ways"-way sets of
+ *     config.line bytes, as given by the "size:ways" value of the
+ *     variable "name", or "dflt" if it is not set
+ */
+static void configure_level(struct cachesim_level *level, size_t *size,
+    int *ways, const char *name, const char *dflt)
+{
+    const char *spec = getenv(name);
+    char *end;
+    size_t sets;
+    long n;
+
+    if (spec == NULL || *spec == '\0')
+	spec = dflt;
+    *size = parse_bytes(spec, &end);
+    if (*size == 0 || *end != ':')
+	bad_spec(name, spec, "expected size:ways");
+    errno = 0;
+    n = strtol(end + 1, &end, 10);
+    if (errno != 0 || *end != '\0' || n < 1 || n > 64)
+	bad_spec(name, spec, "ways must be 1 to 64");
+    *ways = (int)n;
+    sets = *size / config.line / *ways;
+    if (sets == 0 || sets * config.line * *ways != *size ||
+	(sets & (sets - 1)) != 0)
+	bad_spec(name, spec, "size must be ways times a power of 2 of lines");
+
+    level->ways = *ways;
+    level->set_mask = sets - 1;
+    level->tags = (uint64_t *)calloc(sets * *ways, sizeof(uint64_t));
+    level->used = (uint64_t *)calloc(sets * *ways, sizeof(uint64_t));
+    if (level->tags == NULL || level->used == NULL) {
+	fprintf(stderr, "cachesim: out of memory for %s\n", name);
+	exit(1);
+    }
+}
+
+/*
+ * configure - read the geometry from the environment and allocate the
+ *     levels, the first time it is called
+ */
+static void configure(void)
+{
+    const char *spec;
+    char *end;
+
+    if (config.line != 0)
+	return;
+    if ((spec = getenv("CACHESIM_LINE")) == NULL || *spec == '\0')
+	spec = LINE_DEFAULT;
+    config.line = parse_bytes(spec, &end);
+    if (*end != '\0' || config.line < 8 ||
+	(config.line & (config.line - 1)) != 0)
+	bad_spec("CACHESIM_LINE", spec, "expected a power of 2 of at least 8");
+    for (line_shift = 0; ((size_t)1 << line_shift) < config.line; line_shift++)
+	;
+    configure_level(&l1, &config.l1_size, &config.l1_ways, "CACHESIM_L1",
+		    L1_DEFAULT);
+    configure_level(&l2, &config.l2_size, &config.l2_ways, "CACHESIM_L2",
+		    L2_DEFAULT);
+}
+
+/*
+ * lookup - look up "line" in "level", filling it in place of the least
+ *     recently used way of its set if it is missing.  Returns 1 on a hit
+ *     and 0 on a miss.
+ */
+static int lookup(struct cachesim_level *level, uint64_t line)
+{
+    uint64_t *tags = level->tags + (line & level->set_mask) * level->ways;
+    uint64_t *used = level->used + (line & level->set_mask) * level->ways;
+    int w, victim = 0;
+
+    for (w = 0; w < level->ways; w++) {
+	if (tags[w] == line + 1) {
+	    used[w] = clock_now;
+	    return 1;
+	}
+	if (used[w] < used[victim])
+	    victim = w;
+    }
+    tags[victim] = line + 1;
+    used[victim] = clock_now;
+    return 0;
+}
+
+/*
+ * cachesim_config - return the geometry simulated
+ */
+const struct cachesim_config *cachesim_config(void)
+{
+    configure();
+    return &config;
+}
+
+/*
+ * cachesim_start - empty the caches, zero the counts, and simulate the
+ *     accesses reported from now on, with line 0 starting at "base"
+ */
+void cachesim_start(const void *base)
+{
+    configure();
+    memset(l1.tags, 0, (l1.set_mask + 1) * l1.ways * sizeof(uint64_t));
+    memset(l1.used, 0, (l1.set_mask + 1) * l1.ways * sizeof(uint64_t));
+    memset(l2.tags, 0, (l2.set_mask + 1) * l2.ways * sizeof(uint64_t));
+    memset(l2.used, 0, (l2.set_mask + 1) * l2.ways * sizeof(uint64_t));
+    memset(&counts, 0, sizeof(counts));
+    base_addr = (uintptr_t)base;
+    clock_now = 0;
+    cachesim_on = 1;
+}
+
+/*
+ * cachesim_stop - stop simulating and store the counts in "stats"
+ */
+void cachesim_stop(struct cachesim_stats *stats)
+{
+    cachesim_on = 0;
+    *stats = counts;
+}
+
+/*
+ * cachesim_access - simulate reading or writing the "size" bytes at "addr"
+ */
+void cachesim_access(const void *addr, size_t size)
+{
+    uint64_t line = ((uintptr_t)addr - base_addr) >> line_shift;
+    uint64_t last = ((uintptr_t)addr - base_addr + size - 1) >> line_shift;
+
+    for (; line <= last; line++) {
+	clock_now++;
+	counts.accesses++;
+	if (lookup(&l1, line))
+	    continue;
+	counts.l1_misses++;
+	if (!lookup(&l2, line))
+	    counts.l2_misses++;
+    }
+}
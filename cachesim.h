@@ -0,0 +1,51 @@
+/*
+ * cachesim.h - a simulated two-level cache fed by mm.c's metadata accesses
+ *
+ * When mm.c is compiled with -DMM_CACHESIM (make CACHESIM=1), GET, PUT
+ * and the free list node accesses report each address they touch with
+ * CACHE_TOUCH().  Otherwise CACHE_TOUCH() compiles to nothing.  While the
+ * simulation is on, every access looks up its lines in an LRU
+ * set-associative L1 and, on a miss, in an L2; a line missing from a
+ * level is filled there.  Addresses are taken relative to the base given
+ * to cachesim_start, so the same requests always give the same misses.
+ *
+ * The geometry comes from the environment: CACHESIM_L1 and CACHESIM_L2
+ * hold a level's "size:ways" (K and M suffixes ok), and CACHESIM_LINE its
+ * line size in bytes.  The defaults are a 32K 8-way L1, a 1M 16-way L2,
+ * and 64-byte lines.
+ */
+#ifndef __CACHESIM_H_
+#define __CACHESIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The geometry simulated */
+struct cachesim_config {
+	size_t l1_size, l2_size;  /* bytes */
+	int l1_ways, l2_ways;
+	size_t line;              /* line size in bytes */
+};
+
+/* Counts since cachesim_start */
+struct cachesim_stats {
+	uint64_t accesses;   /* lines looked up in the L1 */
+	uint64_t l1_misses;  /* of them, lines looked up in the L2 */
+	uint64_t l2_misses;  /* of them, lines missing from the L2 too */
+};
+
+extern int cachesim_on;  /* set between cachesim_start and cachesim_stop */
+
+const struct cachesim_config *cachesim_config(void);
+void	cachesim_start(const void *base);
+void	cachesim_stop(struct cachesim_stats *stats);
+void	cachesim_access(const void *addr, size_t size);
+
+#ifdef MM_CACHESIM
+#define CACHE_TOUCH(addr, size) \
+	(cachesim_on ? cachesim_access((addr), (size)) : (void)0)
+#else
+#define CACHE_TOUCH(addr, size) ((void)0)
+#endif
+
+#endif /* __CACHESIM_H_ */
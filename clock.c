@@ -1,6 +1,6 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
+ *           AArch64, Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -10,8 +10,19 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/times.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
+/* counter_hz fits the counter's rate over this many samples this far apart */
+#define CAL_SAMPLES 20
+#define CAL_GAP_NS  1000000
+
+static double fit_hz(void);
+static double mono_ns(void);
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -133,6 +144,27 @@ double get_counter()
     return result;
 }
 
+#elif defined(__x86_64__) || defined(__aarch64__)
+
+/****************************************************************
+ * x86-64 and AArch64 versions of start_counter() and get_counter(),
+ * which read the counter with read_counter() in clock.h
+ ****************************************************************/
+
+static uint64_t cyc_start = 0;
+
+/* Record the current value of the cycle counter. */
+void start_counter()
+{
+    cyc_start = read_counter();
+}
+
+/* Return the number of cycles since the last call to start_counter. */
+double get_counter()
+{
+    return (double)(read_counter() - cyc_start);
+}
+
 #else
 
 /****************************************************************
@@ -195,10 +227,95 @@ double mhz_full(int verbose, int sleeptime)
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* Version using the counter's calibrated rate, without sleeping */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    double rate = counter_hz() / 1e6;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+#endif
+
+    if (verbose) 
+	printf("Cycle counter rate ~= %.1f MHz\n", rate);
+#if defined(__x86_64__) || defined(__i386__)
+    /* CPUID leaf 0x80000007 reports a TSC that ticks at a constant rate */
+    if (verbose && (!__get_cpuid(0x80000007, &a, &b, &c, &d) ||
+		    !(d & (1 << 8))))
+	printf("Warning: the TSC may vary with the clock frequency\n");
+#endif
+    return rate;
+}
+
+/*
+ * counter_hz - Return the rate of read_counter() in ticks per second.
+ * AArch64 reports it, as does CPUID leaf 0x15 on recent x86 processors,
+ * as a ratio to the core crystal's frequency.  Otherwise it is the slope
+ * of a least squares fit of the counter against the monotonic clock.
+ */
+double counter_hz(void)
+{
+    static double hz = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+#elif defined(__aarch64__)
+    uint64_t f;
+#endif
+
+    if (hz > 0)
+	return hz;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__get_cpuid(0x15, &a, &b, &c, &d) && a != 0 && b != 0 && c != 0)
+	hz = (double)c * b / a;
+#elif defined(__aarch64__)
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (f));
+    hz = f;
+#else
+    hz = 1e9;   /* read_counter() reads the monotonic clock */
+#endif
+    if (hz <= 0)
+	hz = fit_hz();
+    return hz;
+}
+
+/* Fit the counter's rate to CAL_SAMPLES readings over about 20 ms */
+static double fit_hz(void)
+{
+    double x[CAL_SAMPLES], y[CAL_SAMPLES];
+    double mx = 0, my = 0, sxy = 0, sxx = 0, start;
+    uint64_t c0, c1, base;
+    int i;
+
+    start = mono_ns();
+    base = read_counter();
+    for (i = 0; i < CAL_SAMPLES; i++) {
+	while (mono_ns() - start < (double)i * CAL_GAP_NS)
+	    ;
+	/* Pair the clock with the counter halfway between two reads */
+	c0 = read_counter();
+	x[i] = mono_ns() - start;
+	c1 = read_counter();
+	y[i] = (double)(c0 - base) + (double)(c1 - c0) / 2;
+	mx += x[i] / CAL_SAMPLES;
+	my += y[i] / CAL_SAMPLES;
+    }
+    for (i = 0; i < CAL_SAMPLES; i++) {
+	sxy += (x[i] - mx) * (y[i] - my);
+	sxx += (x[i] - mx) * (x[i] - mx);
+    }
+    return sxy / sxx * 1e9;
+}
+
+/* Read the raw monotonic clock in nanoseconds */
+static double mono_ns(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_RAW
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -1,4 +1,41 @@
 /* Routines for using cycle counter */
+#ifndef __CLOCK_H_
+#define __CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Read the cycle counter: the TSC on x86, fenced so that it counts only
+ * the instructions before it, or the virtual counter on AArch64.  Other
+ * machines get the monotonic clock in nanoseconds.  counter_hz gives the
+ * rate.
+ */
+static inline uint64_t read_counter(void)
+{
+#if defined(__x86_64__)
+    uint32_t lo, hi, aux;
+
+    __asm__ __volatile__("rdtscp; lfence"
+			 : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t t;
+
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (t) : : "memory");
+    return t;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Rate of read_counter in ticks per second, found once and remembered */
+double counter_hz(void);
 
 /* Start the counter */
 void start_counter();
@@ -20,3 +57,5 @@ double mhz_full(int verbose, int sleeptime);
 void start_comp_counter();
 
 double get_comp_counter();
+
+#endif /* __CLOCK_H_ */
@@ -58,7 +58,8 @@
 #define ALIGNMENT 8
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes.  You can override it at runtime
+ * with the MEM_MAX_HEAP environment variable or the driver's -m flag.
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
@@ -67,6 +68,13 @@
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_MONO   1   /* median of adaptive CLOCK_MONOTONIC_RAW runs (Linux) */
+
+/*
+ * With USE_MONO, each trace is timed until the 95% confidence interval on
+ * its median time is within this fraction of the median.
+ */
+#define MONO_TARGET_CI 0.01
 
 #endif /* __CONFIG_H */
@@ -9,6 +9,7 @@
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static struct ftimer_spread spread; /* spread of the last fsecs runs */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,6 +37,9 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_MONO
+    if (verbose)
+	printf("Measuring performance with CLOCK_MONOTONIC_RAW.\n");
 #endif
 }
 
@@ -51,7 +55,17 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_MONO
+    return ftimer_mono(f, argp, MONO_TARGET_CI, &spread);
 #endif 
 }
 
+/*
+ * fsecs_spread - Return the spread of the runs behind the last fsecs
+ */
+void fsecs_spread(struct ftimer_spread *sp)
+{
+    *sp = spread;
+}
+
 
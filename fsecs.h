@@ -1,4 +1,10 @@
+#include "ftimer.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Spread of the runs behind the last fsecs result; runs is 0 unless the
+   timing method measures it */
+void fsecs_spread(struct ftimer_spread *sp);
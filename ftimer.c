@@ -7,14 +7,32 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_mono: version that uses the raw monotonic clock, with warmup
+ *        and as many runs as it takes to pin down the median
  */
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include "ftimer.h"
 
+/* ftimer_mono's limits on the runs it makes */
+#define MONO_WARMUP     2     /* runs discarded before measuring */
+#define MONO_MIN_RUNS   8     /* fewest runs measured */
+#define MONO_MAX_RUNS   200   /* most runs measured... */
+#define MONO_MAX_SECS   1.0   /* ... or seconds spent measuring */
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
+#endif
+
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
+static double mono_secs(void);
+static int cmp_double(const void *a, const void *b);
+static double median(double *x, int n);
 
 /* 
  * ftimer_itimer - Use the interval timer to estimate the running time
@@ -52,6 +70,79 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/* 
+ * ftimer_mono - Use the raw monotonic clock to estimate the running time
+ * of f(argp).  After MONO_WARMUP runs that warm the caches and the heap,
+ * time single runs until a distribution-free 95% confidence interval on
+ * their median is within "target" times the median, or until the limits
+ * above are reached.  Return the median, which ignores the occasional
+ * run that an interrupt or migration slows down.
+ */
+double ftimer_mono(ftimer_test_funct f, void *argp, double target,
+		   struct ftimer_spread *sp)
+{
+    static double t[MONO_MAX_RUNS], dev[MONO_MAX_RUNS];
+    double start, spent = 0, med = 0, half = 0, z;
+    int i, n, lo, hi;
+
+    for (i = 0; i < MONO_WARMUP; i++)
+	f(argp);
+    for (n = 0; n < MONO_MAX_RUNS; ) {
+	start = mono_secs();
+	f(argp);
+	t[n++] = mono_secs() - start;
+	spent += t[n - 1];
+	if (n < MONO_MIN_RUNS)
+	    continue;
+
+	/* The CI's ends are the order statistics n/2 -+ 0.98 sqrt(n) */
+	qsort(t, n, sizeof(double), cmp_double);
+	med = median(t, n);
+	z = 0.98 * sqrt(n);
+	lo = (int)floor(n / 2.0 - z);
+	hi = (int)ceil(n / 2.0 + z);
+	lo = (lo < 0) ? 0 : lo;
+	hi = (hi > n - 1) ? n - 1 : hi;
+	half = (t[hi] - t[lo]) / 2;
+	if (half <= target * med || spent >= MONO_MAX_SECS)
+	    break;
+    }
+
+    if (sp != NULL) {
+	for (i = 0; i < n; i++)
+	    dev[i] = fabs(t[i] - med);
+	qsort(dev, n, sizeof(double), cmp_double);
+	sp->median = med;
+	sp->mad = median(dev, n);
+	sp->ci = half;
+	sp->runs = n;
+    }
+    return med;
+}
+
+/* mono_secs - read the raw monotonic clock in seconds */
+static double mono_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* cmp_double - order doubles for qsort */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* median - return the median of the n sorted values in x */
+static double median(double *x, int n)
+{
+    return (n % 2) ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+}
+
 
 /*
  * Routines for manipulating the Unix interval timer
@@ -1,6 +1,9 @@
 /* 
  * Function timers 
  */
+#ifndef __FTIMER_H_
+#define __FTIMER_H_
+
 typedef void (*ftimer_test_funct)(void *); 
 
 /* Estimate the running time of f(argp) using the Unix interval timer.
@@ -12,3 +15,18 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* How the times of the runs behind an estimate were spread */
+struct ftimer_spread {
+    double median;  /* median time of a run, in seconds */
+    double mad;     /* median absolute deviation from it */
+    double ci;      /* half-width of a 95% confidence interval on it */
+    int runs;       /* runs measured, after warmup */
+};
+
+/* Estimate the running time of f(argp) using CLOCK_MONOTONIC_RAW, running
+   it until the confidence interval is within "target" of the median.
+   Return the median, and fill in *sp if sp is not NULL */
+double ftimer_mono(ftimer_test_funct f, void *argp, double target,
+		   struct ftimer_spread *sp);
+
+#endif /* __FTIMER_H_ */
@@ -0,0 +1,76 @@
+/*
+ * lathist.c - merging, percentiles and clock overhead for lathist.h
+ */
+#include <string.h>
+
+#include "clock.h"
+#include "lathist.h"
+
+/*
+ * lathist_reset - empty "h"
+ */
+void lathist_reset(struct lathist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * lathist_merge - add the values counted in "from" to "to"
+ */
+void lathist_merge(struct lathist *to, const struct lathist *from)
+{
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++)
+	to->buckets[i] += from->buckets[i];
+    to->count += from->count;
+    if (from->max > to->max)
+	to->max = from->max;
+}
+
+/*
+ * lathist_percentile - return a value that "pct" percent of the values in
+ *     "h" do not exceed: the largest value of the bucket holding that
+ *     rank, or the largest value recorded if that is less.  Returns 0 if
+ *     "h" is empty.
+ */
+uint64_t lathist_percentile(const struct lathist *h, double pct)
+{
+    uint64_t rank, seen = 0, hi;
+    int i, e;
+
+    if (h->count == 0)
+	return 0;
+    rank = (uint64_t)(pct / 100 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (i = 0; i < LAT_BUCKETS - 1; i++)
+	if ((seen += h->buckets[i]) >= rank)
+	    break;
+    if (i < LAT_SUB)
+	hi = i;
+    else {
+	e = (i >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	hi = ((uint64_t)(LAT_SUB + (i & (LAT_SUB - 1))) << (e - LAT_SUB_BITS)) +
+	    ((uint64_t)1 << (e - LAT_SUB_BITS)) - 1;
+    }
+    return (hi < h->max) ? hi : h->max;
+}
+
+/*
+ * lathist_overhead - return the fewest ticks seen between two successive
+ *     read_counter() calls, which every recorded latency includes
+ */
+uint64_t lathist_overhead(void)
+{
+    uint64_t t, best = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+	t = read_counter();
+	t = read_counter() - t;
+	if (t < best)
+	    best = t;
+    }
+    return best;
+}
@@ -0,0 +1,51 @@
+/*
+ * lathist.h - log-linear latency histograms
+ *
+ * In the manner of HdrHistogram, a histogram counts values below LAT_SUB
+ * exactly and splits each larger power of two into LAT_SUB equal
+ * buckets, so that any value is recorded to within 1/LAT_SUB of itself.
+ * Recording is a bit scan and an increment.  mdriver -l times every
+ * request of a trace in read_counter() ticks (see clock.h) and records
+ * them with one histogram per request type.
+ */
+#ifndef __LATHIST_H_
+#define __LATHIST_H_
+
+#include <stdint.h>
+
+#define LAT_SUB_BITS  5
+#define LAT_SUB       (1 << LAT_SUB_BITS)  /* buckets per power of two */
+#define LAT_BUCKETS   ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct lathist {
+	uint64_t count;                 /* values recorded */
+	uint64_t max;                   /* the largest of them */
+	uint64_t buckets[LAT_BUCKETS];
+};
+
+void	 lathist_reset(struct lathist *h);
+void	 lathist_merge(struct lathist *to, const struct lathist *from);
+uint64_t lathist_percentile(const struct lathist *h, double pct);
+uint64_t lathist_overhead(void);
+
+/*
+ * lathist_record - count the value "v" in "h"
+ */
+static inline void
+lathist_record(struct lathist *h, uint64_t v)
+{
+	int e;
+
+	if (v < LAT_SUB)
+		h->buckets[v]++;
+	else {
+		e = 63 - __builtin_clzll(v);
+		h->buckets[((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+		    ((v >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1))]++;
+	}
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+#endif /* __LATHIST_H_ */
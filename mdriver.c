@@ -15,11 +15,24 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "mmtrace.h"
+#include "tracebin.h"
+#include "lathist.h"
+#include "perfctr.h"
+#include "cachesim.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
 
 /**********************
@@ -30,6 +43,20 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+
+/* Trace files of at least PARSE_SPLIT bytes are parsed in parallel */
+#define PARSE_SPLIT   (1 << 22)
+#define PARSE_THREADS 8      /* most threads parsing one trace */
+
+/* Streamed traces (-S) are replayed through a window of two halves */
+#define STREAM_WINDOW (1 << 16) /* requests in each half of the window */
+
+/* With -b, ballast is allocated in blocks of BALLAST_SIZE bytes */
+#define BALLAST_SIZE 4096
+
+/* Home entry of an id in a streamed trace's id table */
+#define ID_HASH(id, mask) (((id) * 2654435761u) & (mask))
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
@@ -38,31 +65,96 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, in an AVL tree keyed by lo */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* subtree of lower payloads */
+    struct range_t *right; /* subtree of higher payloads */
+    int height;            /* height of this subtree; a leaf's is 1 */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC} type; /* type of request, as in tracebin.h */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
 } traceop_t;
 
+/*
+ * A trace replayed as it is read (-S), for traces too large to load.  A
+ * reader thread decodes requests from the mapped file into one half of a
+ * window while replay consumes the other.  The reader also renames each
+ * id to a slot, reusing the slots of freed ids, so that the blocks arrays
+ * need only hold the blocks live at once.
+ */
+typedef struct {
+    char *path;                 /* the trace file, for error messages */
+    const char *lo, *hi;        /* its requests, mapped */
+    int binary;                 /* nonzero if they are in tracebin form */
+    unsigned first_line;        /* line number of lo in a text trace */
+    unsigned num_ids;           /* ids the trace header allows */
+    unsigned num_ops;           /* requests the trace header promises */
+    traceop_t *half[2];         /* the window... */
+    unsigned len[2];            /* ... requests in each half... */
+    unsigned slots[2];          /* ... slots used up to each half's end... */
+    int filled[2];              /* ... and which halves await replay */
+    int stop;                   /* tells the reader to quit early */
+    int running;                /* set while the reader thread exists */
+    pthread_t reader;
+    pthread_mutex_t lock;       /* guards len through stop */
+    pthread_cond_t cond;        /* signalled when they change */
+    unsigned *keys;             /* live ids plus one, open-addressed... */
+    unsigned *vals;             /* ... and their slots */
+    unsigned table_size;        /* entries in keys, a power of two */
+    unsigned num_live;          /* ids in keys */
+    unsigned *free_slots;       /* slots of freed ids, to reuse first */
+    unsigned num_free;
+    unsigned num_slots;         /* slots handed out so far */
+    unsigned blocks_size;       /* slots the blocks arrays hold */
+} stream_t;
+
 /* Holds the information for one trace file*/
 typedef struct {
     unsigned sugg_heapsize;   /* suggested heap size (unused) */
     unsigned num_ids;         /* number of alloc/realloc ids */
     unsigned num_ops;         /* number of distinct requests */
     unsigned weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
+    traceop_t *ops;      /* array of requests, or NULL if binary */
+    const unsigned char *data; /* encoded requests of a binary trace */
+    void *map;           /* the mapped binary trace file... */
+    size_t map_size;     /* ... and its size */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    stream_t *stream;    /* set if the trace is streamed */
 } trace_t;
 
+/* Steps through a trace's requests, whichever form the trace is in */
+typedef struct {
+    const traceop_t *op;        /* next request of a text or streamed trace */
+    const traceop_t *end;       /* end of the requests op points into */
+    const unsigned char *data;  /* next request of a binary trace */
+    int index;                  /* id of the last binary request */
+    trace_t *trace;             /* the trace */
+    stream_t *stream;           /* its stream, if any... */
+    int half;                   /* ... and the half of the window op is in */
+} cursor_t;
+
+/*
+ * One piece of a trace file's requests, parsed by its own thread.  The
+ * pieces split the file at line boundaries.
+ */
+typedef struct {
+    const char *lo, *hi;     /* the piece of the file */
+    traceop_t *ops;          /* where its requests go */
+    unsigned num_ops;        /* requests in the piece */
+    unsigned num_lines;      /* lines in the piece */
+    unsigned num_ids;        /* ids the trace header allows */
+    unsigned max_index;      /* largest id used */
+    unsigned err_line;       /* line of the first error, counted from 1 */
+    const char *err;         /* the first error, or NULL */
+} parse_job_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -71,6 +163,7 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    struct lathist *lat; /* if set, record each request's latency here */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -79,18 +172,36 @@ typedef struct {
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    struct ftimer_spread spread; /* how the timed runs' secs varied */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    struct mm_stats mm; /* allocator counters, heap make-up at peak util */
+    struct lathist *lat; /* request latencies by type (-l), or NULL */
+    uint64_t counts[PERFCTR_MAX]; /* events counted in one run (-e) */
+    struct cachesim_stats cache; /* simulated misses of one run (CACHESIM) */
+    size_t pressure; /* allocations that hit the budget while checking (-b) */
+    size_t shed;     /* ballast blocks the pressure callback freed (-b) */
+    double hutil;    /* space utilization replayed through handles (-C)... */
+    size_t live;     /* ... and the payload bytes live at the end... */
+    size_t heap_before; /* ... with the heap's size before... */
+    size_t heap_after;  /* ... and after mm_compact */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* What a worker process (-j) sends back about the trace it checked */
+typedef struct {
+    stats_t stats;   /* the trace's stats, all but secs */
+    int errors;      /* errors the worker found */
+} result_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int check_window = 0; /* blocks mm checks per op in eval_mm_valid (-c) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -101,29 +212,104 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* Replay traces as they are read instead of loading them first (-S) */
+static int stream_traces = 0;
+
+/* Most traces checked at once, each in its own worker process (-j) */
+static int num_jobs = 1;
+
+/* Time each request of one more speed run per trace (-l) */
+static int record_latency = 0;
+
+/* Run mm's maintenance thread with this period in ms, or 0 (-M) */
+static unsigned int maint_period = 0;
+
+/*
+ * Check each trace with the heap capped at this many bytes, or 0 (-b).
+ * Half the budget is first filled with ballast blocks, which the pressure
+ * callback frees, from inside mm_malloc, as the trace needs room.
+ */
+static size_t heap_budget = 0;
+static char **ballast;           /* the ballast blocks still allocated... */
+static int ballast_count;        /* ... and how many there are */
+static size_t ballast_shed;      /* ballast blocks freed by the callback */
+static range_t **ballast_ranges; /* the range tree they are recorded in */
+
+/* Replay each trace once more through mm's movable handles (-C) */
+static int use_handles = 0;
+
+/* Count events in one more speed run per trace with these counters (-e) */
+static int count_events = 0;
+static struct perfctr_set counters;
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *floor_range(range_t *p, char *addr);
+static range_t *insert_range(range_t *p, range_t *r);
+static range_t *delete_range(range_t *p, char *lo);
+static range_t *balance_range(range_t *p);
+static range_t *rotate_range(range_t *p, int right);
+static int range_height(range_t *p);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_bintrace(trace_t *trace, char *path, char *map, size_t len);
 static void free_trace(trace_t *trace);
+static void start_ops(trace_t *trace, cursor_t *cur);
+static inline void next_op(cursor_t *cur, traceop_t *op);
+static void *count_ops(void *arg);
+static void *parse_ops(void *arg);
+static void run_jobs(parse_job_t *jobs, int n, void *(*fn)(void *));
+static const char *parse_line(const char **pp, const char *end,
+			      unsigned num_ids, traceop_t *op);
+
+/* These functions stream traces (-S) */
+static void open_stream(trace_t *trace, char *path, char *map, size_t len,
+			const char *lo, unsigned first_line, int binary);
+static void start_stream(stream_t *s);
+static void stop_stream(stream_t *s);
+static void next_window(cursor_t *cur);
+static void *read_stream(void *arg);
+static void stream_error(stream_t *s, unsigned i, unsigned line,
+			 const char *err);
+static const char *remap_id(stream_t *s, traceop_t *op);
+static unsigned find_id(stream_t *s, unsigned id);
+static void grow_ids(stream_t *s);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static int reset_heap(void);
+static int add_ballast(range_t **ranges, int tracenum);
+static int shed_ballast(size_t bytes);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   struct mm_stats *mmstats);
+static int eval_mm_handles(trace_t *trace, int tracenum, stats_t *stats);
+static int same_fill(const char *p, unsigned size, int index);
 static void eval_mm_speed(void *ptr);
+static void check_trace(trace_t *trace, int tracenum, range_t **ranges,
+			stats_t *stats, size_t prof_interval);
+static void check_traces(char **tracefiles, int n, stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printmmstats(int n, stats_t *stats);
+static void printhandles(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+#ifdef MM_CACHESIM
+static void printcache(int n, stats_t *stats);
+#endif
+static void printhist(char *name, size_t *hist);
+static void printslow(char *name, struct mm_slow_op *slow);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -145,6 +331,10 @@ int main(int argc, char **argv)
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    char *tracefile = NULL; /* If set, dump mm's event trace here (-T) */
+    char *proffile = NULL;  /* If set, dump mm's heap profile here (-P) */
+    size_t prof_interval = 0; /* Mean bytes between profile samples (-p) */
+    size_t len;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -153,7 +343,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "gf:t:avVh")) != EOF) {
+    while ((c = getopt(argc, argv, "gf:t:m:b:c:j:p:M:P:T:aACeHlSvVh")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -173,9 +363,59 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'b': /* Check traces under a heap budget */
+	    if ((heap_budget = strtoul(optarg, NULL, 0)) < 2 * BALLAST_SIZE)
+		app_error("-b needs a budget of at least 8192 bytes");
+	    break;
+	case 'c': /* Check the heap incrementally while validating */
+	    check_window = atoi(optarg);
+	    break;
+	case 'j': /* Check traces in parallel worker processes */
+	    if ((num_jobs = atoi(optarg)) < 1)
+		app_error("-j needs a positive number of workers");
+	    break;
+	case 'M': /* Run mm's maintenance thread */
+	    if ((int)(maint_period = atoi(optarg)) < 1)
+		app_error("-M needs a positive period in milliseconds");
+	    break;
+	case 'p': /* Heap profile sampling interval in bytes */
+	    prof_interval = strtoul(optarg, NULL, 0);
+	    break;
+	case 'P': /* Dump mm's heap profile to a file at exit */
+	    proffile = optarg;
+	    break;
+	case 'T': /* Dump mm's event trace to a file at exit */
+#ifndef MM_TRACE
+	    app_error("-T needs a build with event tracing (make TRACE=1)");
+#endif
+	    tracefile = optarg;
+	    break;
+	case 'm': /* Maximum heap size, read by mem_init() */
+	    if (setenv("MEM_MAX_HEAP", optarg, 1) < 0)
+		unix_error("ERROR: setenv failed in main");
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+	case 'A': /* Align large blocks to huge pages */
+	    mm_set_hugepage_align(1);
+	    break;
+	case 'C': /* Replay traces through movable handles too */
+	    use_handles = 1;
+	    break;
+	case 'H': /* Back the heap with transparent huge pages */
+	    if (setenv("MEM_HUGEPAGES", "1", 1) < 0)
+		unix_error("ERROR: setenv failed in main");
+	    break;
+	case 'e': /* Count hardware events */
+	    count_events = 1;
+	    break;
+	case 'l': /* Record request latency histograms */
+	    record_latency = 1;
+	    break;
+	case 'S': /* Stream traces instead of loading them */
+	    stream_traces = 1;
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -227,8 +467,27 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Profiles and event traces are gathered in this process only */
+    if (num_jobs > 1 && (proffile != NULL || tracefile != NULL))
+	app_error("-P and -T cannot be used with -j");
+
+    /* Worker processes would not inherit the maintenance thread */
+    if (num_jobs > 1 && maint_period > 0)
+	app_error("-M cannot be used with -j");
+
+    /* Profile with tcmalloc's default interval unless told otherwise */
+    if (proffile != NULL && prof_interval == 0)
+	prof_interval = 512 * 1024;
+
     /* Initialize the timing package */
     init_fsecs();
+    if (count_events && perfctr_open(&counters) == 0) {
+	printf("Warning: no performance counters are available\n");
+	count_events = 0;
+    }
+#ifdef MM_CACHESIM
+    cachesim_config();  /* Reject a bad cache geometry before any trace */
+#endif
 
     /*
      * Always run and evaluate the student's mm package
@@ -244,32 +503,111 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
+    /*
+     * With -j, check every trace in parallel first.  Throughput is then
+     * measured for one trace at a time below, so that the timings are not
+     * distorted by the workers.
+     */
+    if (num_jobs > 1)
+	check_traces(tracefiles, num_tracefiles, mm_stats);
+    speed_params.lat = NULL;
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
+	if (num_jobs > 1 && !mm_stats[i].valid)
+	    continue;
 	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (num_jobs == 1)
+	    check_trace(trace, i, &ranges, &mm_stats[i], prof_interval);
 	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    fsecs_spread(&mm_stats[i].spread);
+	    if (record_latency) {
+		/* Time each request in one more run */
+		mm_stats[i].lat = (struct lathist *)
+		    calloc(3, sizeof(struct lathist));
+		if (mm_stats[i].lat == NULL)
+		    unix_error("lathist calloc in main failed");
+		speed_params.lat = mm_stats[i].lat;
+		eval_mm_speed(&speed_params);
+		speed_params.lat = NULL;
+	    }
+	    if (count_events) {
+		/* Count events in one more run */
+		perfctr_start(&counters);
+		eval_mm_speed(&speed_params);
+		perfctr_stop(&counters, mm_stats[i].counts);
+	    }
+#ifdef MM_CACHESIM
+	    /* Simulate the allocator's cache misses in one more run */
+	    cachesim_start(mem_heap_lo());
+	    eval_mm_speed(&speed_params);
+	    cachesim_stop(&mm_stats[i].cache);
+#endif
 	}
 	free_trace(trace);
     }
+    if (maint_period > 0)
+	mm_stop_maintenance();
+
+    /*
+     * Save the heap profile of the utilization passes: folded stacks of
+     * the bytes allocated if the file name ends in ".folded", since the
+     * traces free everything, and a pprof heap profile otherwise.
+     */
+    if (proffile != NULL) {
+	len = strlen(proffile);
+	if (mm_prof_dump(proffile, (len >= 7 &&
+	    strcmp(proffile + len - 7, ".folded") == 0) ?
+	    MM_PROF_FOLDED | MM_PROF_CUMULATIVE : 0) < 0)
+	    unix_error("ERROR: mm_prof_dump failed in main");
+    }
+
+    /* Save the most recent allocator events for mmdecode */
+    if (tracefile != NULL && mmtrace_dump(tracefile) < 0)
+	unix_error("ERROR: mmtrace_dump failed in main");
 
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printf("\nAllocator statistics for mm malloc:\n");
+	printmmstats(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (use_handles) {
+	printf("\nResults for mm malloc through movable handles, with the "
+	       "heap at the end\nof each trace before and after mm_compact:\n");
+	printhandles(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (record_latency) {
+	printf("\nRequest latencies for mm malloc in ns, each including "
+	       "about %.0f ns\nof clock overhead:\n",
+	       lathist_overhead() * 1e9 / counter_hz());
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (count_events) {
+	printf("\nEvents per op for mm malloc%s:\n", counters.software ?
+	       " (software events; no hardware counters)" : "");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+	perfctr_close(&counters);
+    }
+#ifdef MM_CACHESIM
+    printf("\nSimulated cache misses per op for mm malloc (%zuK %d-way L1, "
+	   "%zuK %d-way L2,\n%zu-byte lines):\n",
+	   cachesim_config()->l1_size >> 10, cachesim_config()->l1_ways,
+	   cachesim_config()->l2_size >> 10, cachesim_config()->l2_ways,
+	   cachesim_config()->line);
+    printcache(num_tracefiles, mm_stats);
+    printf("\n");
+#endif
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -303,6 +641,10 @@ int main(int argc, char **argv)
 	}
 	
 	perfindex = (p1 + p2)*100.0;
+	if (stream_traces)
+	    printf("Note: with -S the timed runs include reading the trace, "
+		   "so thru is not\ncomparable with that of runs without "
+		   "-S.\n");
 	printf("Perf index = %.0f/%.0f (util) + %.0f/%.0f (thru) = %.0f/100\n",
 	       p1*100, UTIL_WEIGHT*100,
 	       p2*100, (1.0-UTIL_WEIGHT)*100,
@@ -324,16 +666,18 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.  It is an
+ * AVL tree ordered by payload address, so that checking, adding, and
+ * removing a block take time logarithmic in the number of live blocks.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -361,50 +705,38 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads.  The payloads in
+     * the tree don't overlap each other, so only the last one to start
+     * at or below hi can reach lo.
+     */
+    if ((p = floor_range(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    p->height = 1;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
 /* 
  * remove_range - Free the range record of block whose payload starts at lo 
- *
- * XXX alc: It's unclear what the variable "size" was used for.
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    //int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = delete_range(*ranges, lo);
 }
 
 /*
@@ -412,16 +744,132 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
+/*
+ * floor_range - returns the range in the tree p that starts last at or
+ *     below addr, or NULL if there is none
+ */
+static range_t *floor_range(range_t *p, char *addr)
+{
+    range_t *best = NULL;
+
+    while (p != NULL) {
+	if (p->lo <= addr) {
+	    best = p;
+	    p = p->right;
+	} else
+	    p = p->left;
+    }
+    return best;
+}
+
+/*
+ * insert_range - adds the range r to the tree p, which holds no range
+ *     starting at r->lo, and returns the new root
+ */
+static range_t *insert_range(range_t *p, range_t *r)
+{
+    if (p == NULL)
+	return r;
+    if (r->lo < p->lo)
+	p->left = insert_range(p->left, r);
+    else
+	p->right = insert_range(p->right, r);
+    return balance_range(p);
+}
+
+/*
+ * delete_range - frees the range starting at lo, if the tree p holds
+ *     one, and returns the new root
+ */
+static range_t *delete_range(range_t *p, char *lo)
+{
+    range_t *q;
+
+    if (p == NULL)
+	return NULL;
+    if (lo < p->lo)
+	p->left = delete_range(p->left, lo);
+    else if (lo > p->lo)
+	p->right = delete_range(p->right, lo);
+    else {
+	if (p->left == NULL || p->right == NULL) {
+	    q = (p->left != NULL) ? p->left : p->right;
+	    free(p);
+	    return q;
+	}
+
+	/* Replace p's extent with its successor's, and delete that. */
+	for (q = p->right; q->left != NULL; q = q->left)
+	    ;
+	p->lo = q->lo;
+	p->hi = q->hi;
+	p->right = delete_range(p->right, q->lo);
+    }
+    return balance_range(p);
+}
+
+/*
+ * balance_range - restores the height of the tree p, whose subtrees are
+ *     balanced and differ in height by at most 2, and returns the new root
+ */
+static range_t *balance_range(range_t *p)
+{
+    int diff = range_height(p->left) - range_height(p->right);
+
+    if (diff > 1) {
+	if (range_height(p->left->left) < range_height(p->left->right))
+	    p->left = rotate_range(p->left, 0);
+	return rotate_range(p, 1);
+    }
+    if (diff < -1) {
+	if (range_height(p->right->right) < range_height(p->right->left))
+	    p->right = rotate_range(p->right, 1);
+	return rotate_range(p, 0);
+    }
+    p->height = 1 + MAX(range_height(p->left), range_height(p->right));
+    return p;
+}
+
+/*
+ * rotate_range - rotates the tree p right (its left child becomes the
+ *     root) if right is nonzero, or left otherwise, and returns the new root
+ */
+static range_t *rotate_range(range_t *p, int right)
+{
+    range_t *q;
+
+    if (right) {
+	q = p->left;
+	p->left = q->right;
+	q->right = p;
+    } else {
+	q = p->right;
+	p->right = q->left;
+	q->left = p;
+    }
+    p->height = 1 + MAX(range_height(p->left), range_height(p->right));
+    q->height = 1 + MAX(range_height(q->left), range_height(q->right));
+    return q;
+}
+
+/*
+ * range_height - returns the height of the tree p, 0 if it is empty
+ */
+static int range_height(range_t *p)
+{
+    return (p == NULL) ? 0 : p->height;
+}
+
 
 /**********************************************
  * The following routines manipulate tracefiles
@@ -429,16 +877,26 @@ static void clear_ranges(range_t **ranges)
 
 /*
  * read_trace - read a trace file and store it in memory
+ *
+ * The file is mapped rather than read, and parsed by hand.  Large files
+ * are split at line boundaries and parsed by several threads: one pass
+ * counts each piece's requests, so that the second can parse each piece
+ * straight into its place in the ops array.  Any malformed line is
+ * reported with its line number.  With -S the requests are left in the
+ * file, to be read as they are replayed.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    parse_job_t jobs[PARSE_THREADS];
+    unsigned *header[4];
+    unsigned lines, max_index, num_ops;
+    const char *p, *end, *split;
+    struct stat st;
+    char *map;
+    int fd, i, njobs;
+    long ncpus;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -446,18 +904,59 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->stream = NULL;
 	
-    /* Read the trace file header */
+    /* Map the trace file */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%u", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%u", &(trace->num_ids));     
-    fscanf(tracefile, "%u", &(trace->num_ops));     
-    fscanf(tracefile, "%u", &(trace->weight));        /* not used */
+    if (st.st_size == 0) {
+	sprintf(msg, "%s: empty trace file", path);
+	app_error(msg);
+    }
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+	MAP_FAILED) {
+	sprintf(msg, "Could not map %s in read_trace", path);
+	unix_error(msg);
+    }
+    close(fd);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    end = map + st.st_size;
+
+    /* Binary traces are replayed from the mapping itself */
+    if ((size_t)st.st_size >= sizeof(uint32_t) &&
+	*(uint32_t *)map == TRACEBIN_MAGIC) {
+	read_bintrace(trace, path, map, st.st_size);
+	return trace;
+    }
+    trace->data = NULL;
+    trace->map = NULL;
+
+    /* Read the trace file header, which ends with its fourth number */
+    header[0] = &trace->sugg_heapsize;  /* not used */
+    header[1] = &trace->num_ids;
+    header[2] = &trace->num_ops;
+    header[3] = &trace->weight;         /* not used */
+    for (p = map, i = 0, lines = 1; i < 4; i++) {
+	for (; p < end && (*p == '\n' || *p == ' ' || *p == '\t' ||
+			   *p == '\r'); p++)
+	    lines += (*p == '\n');
+	if (!tracebin_scan_uint(&p, end, header[i])) {
+	    sprintf(msg, "%s, line %u: bad trace header", path, lines);
+	    app_error(msg);
+	}
+    }
+    while (p < end && *p != '\n')
+	p++;
+    if (p < end)
+	p++;
+    if (stream_traces) {
+	open_stream(trace, path, map, st.st_size, p, lines + 1, 0);
+	return trace;
+    }
     
     /* We'll store each request line in the trace in this array */
     if ((trace->ops = 
@@ -474,43 +973,551 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
+    /* Split the requests into one piece per thread */
+    njobs = 1;
+    if (end - p >= PARSE_SPLIT && (ncpus = sysconf(_SC_NPROCESSORS_ONLN)) > 1)
+	njobs = (ncpus < PARSE_THREADS) ? ncpus : PARSE_THREADS;
+    for (i = 0; i < njobs; i++) {
+	jobs[i].lo = p;
+	split = (i == njobs - 1) ? end : jobs[i].lo + (end - p) / (njobs - i);
+	while (split < end && split[-1] != '\n')
+	    split++;
+	jobs[i].hi = p = split;
+	jobs[i].num_ids = trace->num_ids;
+    }
+
+    /* Count each piece's requests, and so where they go */
+    run_jobs(jobs, njobs, count_ops);
+    for (i = 0, num_ops = 0; i < njobs; i++) {
+	if (jobs[i].num_ops > trace->num_ops - num_ops) {
+	    sprintf(msg, "%s: more than the %u requests in the header",
+		    path, trace->num_ops);
+	    app_error(msg);
+	}
+	jobs[i].ops = trace->ops + num_ops;
+	num_ops += jobs[i].num_ops;
+    }
+    if (num_ops != trace->num_ops) {
+	sprintf(msg, "%s: %u requests, but the header says %u",
+		path, num_ops, trace->num_ops);
+	app_error(msg);
+    }
+
+    /* Read every request line in the trace file */
+    run_jobs(jobs, njobs, parse_ops);
+    for (i = 0, max_index = 0; i < njobs; i++) {
+	if (jobs[i].err != NULL) {
+	    sprintf(msg, "%s, line %u: %s", path,
+		    lines + jobs[i].err_line, jobs[i].err);
+	    app_error(msg);
+	}
+	lines += jobs[i].num_lines;
+	max_index = (jobs[i].max_index > max_index) ?
+	    jobs[i].max_index : max_index;
+    }
+    munmap(map, st.st_size);
+    if (num_ops > 0 && max_index != trace->num_ids - 1) {
+	sprintf(msg, "%s: largest id is %u, but the header says %u ids",
+		path, max_index, trace->num_ids);
+	app_error(msg);
+    }
+    
+    return trace;
+}
+
+/*
+ * read_bintrace - fill in "trace" from the binary trace file "path",
+ *     mapped at "map", after checking every request in it.  Replay can
+ *     then decode the requests without checking them again.
+ */
+static void read_bintrace(trace_t *trace, char *path, char *map, size_t len)
+{
+    struct tracebin_hdr hdr;
+    const unsigned char *p, *end;
+    uint32_t key, size;
+    int64_t index = 0;
+    unsigned i, max_index = 0;
+
+    if (len < sizeof(hdr)) {
+	sprintf(msg, "%s: truncated binary trace header", path);
+	app_error(msg);
+    }
+    memcpy(&hdr, map, sizeof(hdr));
+    if (hdr.version != TRACEBIN_VERSION || hdr.hdr_size != sizeof(hdr)) {
+	sprintf(msg, "%s: unsupported binary trace version %u", path,
+		hdr.version);
+	app_error(msg);
+    }
+    if (hdr.data_size != len - sizeof(hdr)) {
+	sprintf(msg, "%s: binary trace is %zu bytes, but the header says %llu",
+		path, len - sizeof(hdr), (unsigned long long)hdr.data_size);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+    if (stream_traces) {
+	open_stream(trace, path, map, len, map + sizeof(hdr), 0, 1);
+	return;
+    }
+
+    p = (const unsigned char *)map + sizeof(hdr);
+    end = (const unsigned char *)map + len;
+    for (i = 0; i < trace->num_ops; i++) {
+	if ((p = tracebin_check(p, end, &key)) == NULL ||
+	    (key & 3) > TB_REALLOC)
+	    break;
+	index += TRACEBIN_UNZIGZAG(key >> 2);
+	if (index < 0 || index >= trace->num_ids)
 	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
+	if ((key & 3) != TB_FREE) {
+	    if ((p = tracebin_check(p, end, &size)) == NULL || size > INT_MAX)
+		break;
+	    max_index = ((unsigned)index > max_index) ?
+		(unsigned)index : max_index;
+	}
+    }
+    if (i < trace->num_ops || p != end) {
+	sprintf(msg, "%s: bad binary trace request %u", path, i);
+	app_error(msg);
+    }
+    if (trace->num_ops > 0 && max_index != trace->num_ids - 1) {
+	sprintf(msg, "%s: largest id is %u, but the header says %u ids",
+		path, max_index, trace->num_ids);
+	app_error(msg);
+    }
+
+    trace->ops = NULL;
+    trace->data = (const unsigned char *)map + sizeof(hdr);
+    trace->map = map;
+    trace->map_size = len;
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
+/*
+ * start_ops - point "cur" at the first request of "trace".  A streamed
+ *     trace is read again from the start.
+ */
+static void start_ops(trace_t *trace, cursor_t *cur)
+{
+    cur->op = trace->ops;
+    cur->end = trace->ops + trace->num_ops;
+    cur->data = trace->data;
+    cur->index = 0;
+    cur->trace = trace;
+    cur->stream = trace->stream;
+    cur->half = 0;
+    if (trace->stream != NULL) {
+	start_stream(trace->stream);
+	cur->op = cur->end = NULL;
+    }
+}
+
+/*
+ * next_op - store the request at "cur" in "op" and advance "cur" past it.
+ *     A binary request is decoded in place.
+ */
+static inline void next_op(cursor_t *cur, traceop_t *op)
+{
+    uint32_t key, size = 0;
+
+    if (cur->data == NULL) {
+	if (cur->op == cur->end)
+	    next_window(cur);
+	*op = *cur->op++;
+	return;
+    }
+    cur->data = tracebin_get(cur->data, &key);
+    if ((key & 3) != TB_FREE)
+	cur->data = tracebin_get(cur->data, &size);
+    cur->index += TRACEBIN_UNZIGZAG(key >> 2);
+    op->type = key & 3;
+    op->index = cur->index;
+    op->size = size;
+}
+
+/*
+ * count_ops - count the lines of a parse job's piece, and the requests
+ *     among them: the lines that are not blank
+ */
+static void *count_ops(void *arg)
+{
+    parse_job_t *job = arg;
+    const char *p, *eol;
+
+    job->num_ops = job->num_lines = 0;
+    for (p = job->lo; p < job->hi; p = eol + 1) {
+	if ((eol = memchr(p, '\n', job->hi - p)) == NULL)
+	    eol = job->hi;
+	job->num_lines++;
+	while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+	    p++;
+	job->num_ops += (p < eol);
+    }
+    return NULL;
+}
+
+/*
+ * parse_ops - parse the requests of a parse job's piece into job->ops,
+ *     stopping at the first malformed line
+ */
+static void *parse_ops(void *arg)
+{
+    parse_job_t *job = arg;
+    const char *p = job->lo, *end = job->hi;
+    traceop_t *op = job->ops;
+    unsigned line;
+
+    job->max_index = 0;
+    job->err = NULL;
+    for (line = 1; p < end; line++, p++) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+	    p++;
+	if (p == end)
 	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
+	if (*p == '\n')
+	    continue;
+	if ((job->err = parse_line(&p, end, job->num_ids, op)) != NULL)
 	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
+	if (op->type != FREE && (unsigned)op->index > job->max_index)
+	    job->max_index = op->index;
+	op++;
+    }
+    job->err_line = line;
+    return NULL;
+}
+
+/*
+ * parse_line - parse the request starting at *pp, the first character of
+ *     a line that is not blank, into "op", and advance *pp to the end of
+ *     the line, as tracebin_parse_line does.  Returns NULL, or what is
+ *     wrong with the line.
+ */
+static const char *parse_line(const char **pp, const char *end,
+			      unsigned num_ids, traceop_t *op)
+{
+    unsigned type, index, size;
+    const char *err;
+
+    if ((err = tracebin_parse_line(pp, end, num_ids, &type, &index,
+				   &size)) != NULL)
+	return err;
+    op->type = type;   /* the types are numbered alike */
+    op->index = index;
+    op->size = size;
+    return NULL;
+}
+
+/*
+ * run_jobs - run fn on each of the n parse jobs, in parallel if n > 1
+ */
+static void run_jobs(parse_job_t *jobs, int n, void *(*fn)(void *))
+{
+    pthread_t tids[PARSE_THREADS];
+    int i;
+
+    for (i = 1; i < n; i++)
+	if (pthread_create(&tids[i], NULL, fn, &jobs[i]) != 0)
+	    unix_error("pthread_create failed in read_trace");
+    fn(&jobs[0]);
+    for (i = 1; i < n; i++)
+	pthread_join(tids[i], NULL);
+}
+
+/*
+ * open_stream - set "trace" up to be streamed from "path", mapped at "map",
+ *     whose requests start at "lo".  Replay starts the reader.
+ */
+static void open_stream(trace_t *trace, char *path, char *map, size_t len,
+			const char *lo, unsigned first_line, int binary)
+{
+    stream_t *s;
+
+    if ((s = (stream_t *)calloc(1, sizeof(stream_t))) == NULL ||
+	(s->path = strdup(path)) == NULL ||
+	(s->half[0] = malloc(STREAM_WINDOW * sizeof(traceop_t))) == NULL ||
+	(s->half[1] = malloc(STREAM_WINDOW * sizeof(traceop_t))) == NULL)
+	unix_error("malloc failed in open_stream");
+    s->lo = lo;
+    s->hi = map + len;
+    s->binary = binary;
+    s->first_line = first_line;
+    s->num_ids = trace->num_ids;
+    s->num_ops = trace->num_ops;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    grow_ids(s);
+
+    trace->ops = NULL;
+    trace->data = NULL;
+    trace->map = map;
+    trace->map_size = len;
+    trace->blocks = NULL;
+    trace->block_sizes = NULL;
+    trace->stream = s;
+}
+
+/*
+ * start_stream - (re)start the reader at the first request, with no ids
+ *     live and the window empty
+ */
+static void start_stream(stream_t *s)
+{
+    stop_stream(s);
+    memset(s->keys, 0, s->table_size * sizeof(unsigned));
+    s->num_live = s->num_free = s->num_slots = 0;
+    s->filled[0] = s->filled[1] = 0;
+    s->stop = 0;
+    if (pthread_create(&s->reader, NULL, read_stream, s) != 0)
+	unix_error("pthread_create failed in start_stream");
+    s->running = 1;
+}
+
+/*
+ * stop_stream - stop the reader, if it is running, and wait for it
+ */
+static void stop_stream(stream_t *s)
+{
+    if (!s->running)
+	return;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->reader, NULL);
+    s->running = 0;
+}
+
+/*
+ * next_window - hand the half of the window "cur" has used up back to the
+ *     reader, if any, and point "cur" at the other half once it is filled.
+ *     The blocks arrays grow to take the slots its requests use.
+ */
+static void next_window(cursor_t *cur)
+{
+    stream_t *s = cur->stream;
+    trace_t *trace;
+    unsigned n;
+
+    pthread_mutex_lock(&s->lock);
+    if (cur->op != NULL) {
+	s->filled[cur->half] = 0;
+	cur->half ^= 1;
+	pthread_cond_broadcast(&s->cond);
+    }
+    while (!s->filled[cur->half])
+	pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+
+    if (s->slots[cur->half] > s->blocks_size) {
+	trace = cur->trace;
+	n = MAX(s->slots[cur->half], 2 * s->blocks_size);
+	if ((trace->blocks = realloc(trace->blocks, n * sizeof(char *))) ==
+	    NULL ||
+	    (trace->block_sizes = realloc(trace->block_sizes,
+					  n * sizeof(size_t))) == NULL)
+	    unix_error("realloc failed in next_window");
+	s->blocks_size = n;
+    }
+    cur->op = s->half[cur->half];
+    cur->end = cur->op + s->len[cur->half];
+}
+
+/*
+ * read_stream - the reader thread: decode the requests of a stream into
+ *     each half of its window in turn, as replay frees them.  The pages
+ *     of the file behind it are dropped as it goes, so that memory use
+ *     stays bounded however large the trace is.
+ */
+static void *read_stream(void *arg)
+{
+    stream_t *s = arg;
+    const char *p = s->lo, *end = s->hi, *dropped, *q;
+    const char *err;
+    traceop_t *op;
+    uint32_t key, size;
+    int64_t index = 0;
+    unsigned i = 0, line = s->first_line, n;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    int half = 0;
+
+    dropped = (const char *)((uintptr_t)p & ~(uintptr_t)(pagesize - 1));
+    while (i < s->num_ops) {
+	pthread_mutex_lock(&s->lock);
+	while (s->filled[half] && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	if (s->stop)
+	    return NULL;
+
+	for (n = 0, op = s->half[half]; n < STREAM_WINDOW && i < s->num_ops;
+	     n++, i++, op++) {
+	    if (s->binary) {
+		if ((p = (const char *)tracebin_check((const unsigned char *)p,
+		    (const unsigned char *)end, &key)) == NULL ||
+		    (key & 3) > TB_REALLOC)
+		    stream_error(s, i, 0, NULL);
+		index += TRACEBIN_UNZIGZAG(key >> 2);
+		size = 0;
+		if (index < 0 || index >= s->num_ids ||
+		    ((key & 3) != TB_FREE &&
+		     ((p = (const char *)tracebin_check((const unsigned char *)p,
+			(const unsigned char *)end, &size)) == NULL ||
+		      size > INT_MAX)))
+		    stream_error(s, i, 0, NULL);
+		op->type = key & 3;
+		op->index = index;
+		op->size = size;
+	    } else {
+		for (;; p++, line++) {
+		    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+		    if (p == end)
+			stream_error(s, i, line, "fewer requests than the "
+				     "header says");
+		    if (*p != '\n')
+			break;
+		}
+		if ((err = parse_line(&p, end, s->num_ids, op)) != NULL)
+		    stream_error(s, i, line, err);
+	    }
+	    if ((err = remap_id(s, op)) != NULL)
+		stream_error(s, i, line, err);
+	    if (!s->binary && p < end) {
+		p++;
+		line++;
+	    }
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->len[half] = n;
+	s->slots[half] = s->num_slots;
+	s->filled[half] = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	half ^= 1;
+
+	q = (const char *)((uintptr_t)p & ~(uintptr_t)(pagesize - 1));
+	if (q > dropped) {
+	    madvise((void *)dropped, q - dropped, MADV_DONTNEED);
+	    dropped = q;
 	}
-	op_index++;
-	
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+
+    /* Nothing but blank lines may follow the last request */
+    if (!s->binary)
+	for (; p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+			   *p == '\n'); p++)
+	    line += (*p == '\n');
+    if (p != end)
+	stream_error(s, i, line, "more requests than the header says");
+    return NULL;
+}
+
+/*
+ * stream_error - report "err" about request i of a stream, on the given
+ *     line of a text trace, and exit
+ */
+static void stream_error(stream_t *s, unsigned i, unsigned line,
+			 const char *err)
+{
+    if (!s->binary)
+	sprintf(msg, "%s, line %u: %s", s->path, line, err);
+    else if (err != NULL)
+	sprintf(msg, "%s: binary trace request %u: %s", s->path, i, err);
+    else
+	sprintf(msg, "%s: bad binary trace request %u", s->path, i);
+    app_error(msg);
+}
+
+/*
+ * remap_id - rename the id of "op" to a slot in the blocks arrays.  An
+ *     allocation takes the slot freed most recently, or a new one, and a
+ *     free gives its slot back.  Returns NULL, or what is wrong with the
+ *     request.
+ */
+static const char *remap_id(stream_t *s, traceop_t *op)
+{
+    unsigned mask = s->table_size - 1, i, j, k, slot;
+
+    i = find_id(s, op->index);
+    if (op->type == ALLOC) {
+	if (s->keys[i] != 0)
+	    return "id allocated twice";
+	slot = (s->num_free > 0) ? s->free_slots[--s->num_free] :
+	    s->num_slots++;
+	s->keys[i] = op->index + 1;
+	s->vals[i] = slot;
+	op->index = slot;
+	if (++s->num_live > s->table_size / 2)
+	    grow_ids(s);
+	return NULL;
+    }
+    if (s->keys[i] == 0)
+	return "id not allocated";
+    op->index = s->vals[i];
+    if (op->type == REALLOC)
+	return NULL;
+
+    /*
+     * Free the slot, and delete the id by shifting back each entry after
+     * it that would no longer be found past the hole.
+     */
+    s->free_slots[s->num_free++] = op->index;
+    s->num_live--;
+    for (j = i; s->keys[j = (j + 1) & mask] != 0; ) {
+	k = ID_HASH(s->keys[j] - 1, mask);
+	if (((j - k) & mask) < ((j - i) & mask))
+	    continue;  /* its home is past the hole */
+	s->keys[i] = s->keys[j];
+	s->vals[i] = s->vals[j];
+	i = j;
+    }
+    s->keys[i] = 0;
+    return NULL;
+}
+
+/*
+ * find_id - return the entry of a stream's id table holding "id", or the
+ *     empty entry where it would go
+ */
+static unsigned find_id(stream_t *s, unsigned id)
+{
+    unsigned mask = s->table_size - 1, i;
+
+    for (i = ID_HASH(id, mask); s->keys[i] != 0; i = (i + 1) & mask)
+	if (s->keys[i] == id + 1)
+	    break;
+    return i;
+}
+
+/*
+ * grow_ids - double the size of a stream's id table, or create it
+ */
+static void grow_ids(stream_t *s)
+{
+    unsigned *keys = s->keys, *vals = s->vals, size = s->table_size, i, j;
+
+    s->table_size = (size > 0) ? 2 * size : 1024;
+    if ((s->keys = calloc(s->table_size, sizeof(unsigned))) == NULL ||
+	(s->vals = malloc(s->table_size * sizeof(unsigned))) == NULL ||
+	(s->free_slots = realloc(s->free_slots,
+				 s->table_size * sizeof(unsigned))) == NULL)
+	unix_error("malloc failed in grow_ids");
+    for (i = 0; i < size; i++)
+	if (keys[i] != 0) {
+	    j = find_id(s, keys[i] - 1);
+	    s->keys[j] = keys[i];
+	    s->vals[j] = vals[i];
+	}
+    free(keys);
+    free(vals);
 }
 
 /*
@@ -522,6 +1529,20 @@ void free_trace(trace_t *trace)
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    if (trace->stream != NULL) { /* stop streaming... */
+	stop_stream(trace->stream);
+	pthread_mutex_destroy(&trace->stream->lock);
+	pthread_cond_destroy(&trace->stream->cond);
+	free(trace->stream->half[0]);
+	free(trace->stream->half[1]);
+	free(trace->stream->keys);
+	free(trace->stream->vals);
+	free(trace->stream->free_slots);
+	free(trace->stream->path);
+	free(trace->stream);
+    }
+    if (trace->map != NULL)   /* unmap a binary or streamed trace... */
+	munmap(trace->map, trace->map_size);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -530,6 +1551,178 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * check_trace - check the mm malloc package for correctness on a trace
+ *     and, if it passes, measure its space utilization
+ */
+static void check_trace(trace_t *trace, int tracenum, range_t **ranges,
+			stats_t *stats, size_t prof_interval)
+{
+    struct mm_stats mmstats;
+
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (heap_budget > 0) {
+	mm_get_stats(&mmstats);
+	stats->pressure = mmstats.pressure_events;
+	stats->shed = ballast_shed;
+    }
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	mm_prof_set_interval(prof_interval); /* Profile one pass only */
+	stats->util = eval_mm_util(trace, tracenum, ranges, &stats->mm);
+	mm_prof_set_interval(0);
+    }
+    if (stats->valid && use_handles) {
+	if (verbose > 1)
+	    printf("handles, ");
+	stats->valid = eval_mm_handles(trace, tracenum, stats);
+    }
+}
+
+/*
+ * check_traces - run check_trace on each of n traces in a worker process
+ *     of its own, with at most num_jobs workers at once.  A worker's heap
+ *     is a copy of this process's unused one.  Its results come back over
+ *     a pipe, which holds all of them, so the worker can exit before they
+ *     are read.  A worker that dies fails its trace.
+ */
+static void check_traces(char **tracefiles, int n, stats_t *stats)
+{
+    result_t result;
+    range_t *ranges = NULL;
+    trace_t *trace;
+    pid_t pid, *pids;
+    int *fds, fd[2], next, running, i, status;
+    size_t got;
+    ssize_t len;
+
+    if ((pids = (pid_t *)malloc(n * sizeof(pid_t))) == NULL ||
+	(fds = (int *)malloc(n * sizeof(int))) == NULL)
+	unix_error("malloc failed in check_traces");
+    for (next = 0, running = 0; next < n || running > 0; ) {
+
+	/* Start the next trace's worker if there is room for it */
+	if (next < n && running < num_jobs) {
+	    fflush(stdout);
+	    if (pipe(fd) < 0 || (pid = fork()) < 0)
+		unix_error("fork failed in check_traces");
+	    if (pid == 0) {
+		close(fd[0]);
+		memset(&result, 0, sizeof(result));
+		errors = 0;
+		trace = read_trace(tracedir, tracefiles[next]);
+		check_trace(trace, next, &ranges, &result.stats, 0);
+		result.errors = errors;
+		fflush(stdout);
+		_exit(write(fd[1], &result, sizeof(result)) != sizeof(result));
+	    }
+	    close(fd[1]);
+	    pids[next] = pid;
+	    fds[next++] = fd[0];
+	    running++;
+	    continue;
+	}
+
+	/* Otherwise collect a finished worker's results */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in check_traces");
+	for (i = 0; i < next && pids[i] != pid; i++)
+	    ;
+	if (i == next)
+	    continue;
+	running--;
+	for (got = 0; got < sizeof(result); got += len)
+	    if ((len = read(fds[i], (char *)&result + got,
+			    sizeof(result) - got)) <= 0)
+		break;
+	close(fds[i]);
+	if (got == sizeof(result)) {
+	    stats[i] = result.stats;
+	    errors += result.errors;
+	    continue;
+	}
+	errors++;
+	stats[i].valid = 0;
+	if (WIFSIGNALED(status))
+	    printf("ERROR [trace %d]: worker killed by signal %d\n", i,
+		   WTERMSIG(status));
+	else
+	    printf("ERROR [trace %d]: worker exited with status %d\n", i,
+		   WEXITSTATUS(status));
+    }
+    free(pids);
+    free(fds);
+}
+
+/*
+ * reset_heap - empty the simulated heap and initialize the mm package on
+ *     it.  With -M, every trace is replayed with the maintenance thread
+ *     running; it is stopped meanwhile, since it may still be working on
+ *     the old heap.  Returns what mm_init returns.
+ */
+static int reset_heap(void)
+{
+    int ret;
+
+    if (maint_period > 0)
+	mm_stop_maintenance();
+    mem_reset_brk();
+    ret = mm_init();
+    mm_set_budget(0, NULL);
+    if (maint_period > 0 && mm_start_maintenance(maint_period) < 0)
+	app_error("-M needs a threaded build (make THREADS=1)");
+    return ret;
+}
+
+/*
+ * add_ballast - allocate BALLAST_SIZE-byte blocks until they hold half
+ *     of heap_budget, recording them in "ranges".  Returns 0 if that fails.
+ */
+static int add_ballast(range_t **ranges, int tracenum)
+{
+    int n = heap_budget / 2 / BALLAST_SIZE;
+
+    if (ballast == NULL &&
+	(ballast = (char **)malloc(n * sizeof(char *))) == NULL)
+	unix_error("ballast malloc in add_ballast failed");
+    ballast_ranges = ranges;
+    ballast_shed = 0;
+    for (ballast_count = 0; ballast_count < n; ballast_count++) {
+	if ((ballast[ballast_count] = mm_malloc(BALLAST_SIZE)) == NULL) {
+	    malloc_error(tracenum, 0, "mm_malloc failed for ballast.");
+	    return 0;
+	}
+	if (add_range(ranges, ballast[ballast_count], BALLAST_SIZE,
+		      tracenum, 0) == 0)
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ * shed_ballast - the pressure callback given to mm_set_budget.  Frees the
+ *     most recent ballast blocks, at least "bytes" of them.  It runs inside
+ *     mm_malloc or mm_realloc, so mm_free is reentered.  Returns nonzero
+ *     if it freed any, so that mm tries again.
+ */
+static int shed_ballast(size_t bytes)
+{
+    size_t freed = 0;
+
+    while (ballast_count > 0 && freed < bytes) {
+	ballast_count--;
+	remove_range(ballast_ranges, ballast[ballast_count]);
+	mm_free(ballast[ballast_count]);
+	freed += BALLAST_SIZE;
+	ballast_shed++;
+    }
+    return (freed > 0);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -542,23 +1735,35 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *newp;
     char *oldp;
     char *p;
+    struct mm_stats mmstats;
+    traceop_t op;
+    cursor_t cur;
     
-    /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
+    /* Free any records in the range tree */
     clear_ranges(ranges);
 
-    /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    /* Reset the heap and call the mm package's init function */
+    if (reset_heap() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    mm_set_check(check_window);
+
+    /* With -b, fill half the budget with ballast and then impose it */
+    if (heap_budget > 0) {
+	if (add_ballast(ranges, tracenum) == 0)
+	    return 0;
+	mm_set_budget(heap_budget, shed_ballast);
+    }
 
     /* Interpret each operation in the trace in order */
+    start_ops(trace, &cur);
     for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+	next_op(&cur, &op);
+	index = op.index;
+	size = op.size;
 
-        switch (trace->ops[i].type) {
+        switch (op.type) {
 
         case ALLOC: /* mm_malloc */
 
@@ -570,7 +1775,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -597,10 +1802,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -612,7 +1817,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -639,6 +1844,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
     }
 
+    /* With -c, the heap must have stayed consistent throughout */
+    if (check_window > 0) {
+	mm_set_check(0);
+	mm_get_stats(&mmstats);
+	if (mmstats.check_errors > 0 || mm_checkheap(0) > 0) {
+	    malloc_error(tracenum, i - 1, "mm_checkheap found an "
+			 "inconsistent heap");
+	    return 0;
+	}
+    }
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
@@ -648,37 +1864,45 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
+ *   peak size of the heap in bytes while running the student's malloc 
  *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   lets the allocator decrement the brk pointer, so the final brk is
+ *   not necessarily the high water mark of the heap. 
+ *
+ *   Also fills in "mmstats" with the allocator's counters for the whole
+ *   trace and the make-up of its heap at the high water mark.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   struct mm_stats *mmstats)
 {   
     unsigned i;
     int index;
     unsigned size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    int snap_size = 0;
+    struct mm_stats counts;
     char *p;
     char *newp, *oldp;
+    traceop_t op;
+    cursor_t cur;
 
     /* Remove the unused variable warnings */
     (void)tracenum;
     (void)ranges;
 
     /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (mm_init() < 0)
+    if (reset_heap() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
+    start_ops(trace, &cur);
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	next_op(&cur, &op);
+        switch (op.type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op.index;
+	    size = op.size;
 
 	    if ((p = mm_malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
@@ -697,8 +1921,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op.index;
+	    newsize = op.size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
@@ -719,7 +1943,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
+	    index = op.index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
@@ -735,11 +1959,135 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* Snapshot the heap at each new high water mark */
+	if (max_total_size > snap_size) {
+	    snap_size = max_total_size;
+	    mm_get_stats(mmstats);
+	}
+    }
+
+    /* Keep the heap make-up at the peak but the counts for the whole trace */
+    mm_get_stats(&counts);
+    counts.heap_bytes = mmstats->heap_bytes;
+    counts.live_bytes = mmstats->live_bytes;
+    memcpy(counts.free_bytes, mmstats->free_bytes, sizeof(counts.free_bytes));
+    counts.largest_free = mmstats->largest_free;
+    counts.frag = mmstats->frag;
+    *mmstats = counts;
+
+    return ((double)max_total_size / (double)mem_peak_heapsize());
+}
+
+
+/*
+ * eval_mm_handles - Replay the trace through mm's movable handles: a
+ *   realloc is a new handle, a copy, and a free.  Each block's data must
+ *   survive until it is freed, however often mm moves it meanwhile.
+ *   Fills in the utilization at the high water mark, as eval_mm_util
+ *   does, and the payload still live at the end of the trace, with the
+ *   heap's size before and after mm_compact.  Returns 0 if a request
+ *   fails or a block loses its data.
+ */
+static int eval_mm_handles(trace_t *trace, int tracenum, stats_t *stats)
+{
+    unsigned i;
+    int index;
+    unsigned size, oldsize;
+    size_t total_size = 0;
+    size_t max_total_size = 0;
+    mm_handle_t h, oldh;
+    char *p;
+    traceop_t op;
+    cursor_t cur;
+
+    if (reset_heap() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    /* The blocks array holds handles instead of pointers in this pass */
+    start_ops(trace, &cur);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	next_op(&cur, &op);
+	index = op.index;
+	size = op.size;
+
+        switch (op.type) {
+
+        case ALLOC: /* mm_halloc */
+	    if ((h = mm_halloc(size)) == 0) {
+		malloc_error(tracenum, i, "mm_halloc failed.");
+		return 0;
+	    }
+	    memset(mm_hderef(h), index & 0xFF, size);
+	    trace->blocks[index] = (char *)(uintptr_t)h;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+        case REALLOC: /* mm_halloc, copy, and mm_hfree */
+	    if ((h = mm_halloc(size)) == 0) {
+		malloc_error(tracenum, i, "mm_halloc failed.");
+		return 0;
+	    }
+
+	    /* The new block may have moved the old one; dereference late */
+	    oldh = (mm_handle_t)(uintptr_t)trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    p = mm_hderef(oldh);
+	    if (!same_fill(p, oldsize, index)) {
+		malloc_error(tracenum, i, "movable block lost its data");
+		return 0;
+	    }
+	    memcpy(mm_hderef(h), p, (size < oldsize) ? size : oldsize);
+	    memset(mm_hderef(h), index & 0xFF, size);
+	    mm_hfree(oldh);
+	    trace->blocks[index] = (char *)(uintptr_t)h;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    total_size -= oldsize;
+	    break;
+
+        case FREE: /* mm_hfree */
+	    h = (mm_handle_t)(uintptr_t)trace->blocks[index];
+	    size = trace->block_sizes[index];
+	    if (!same_fill(mm_hderef(h), size, index)) {
+		malloc_error(tracenum, i, "movable block lost its data");
+		return 0;
+	    }
+	    mm_hfree(h);
+	    total_size -= size;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_handles");
+        }
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->hutil = (double)max_total_size / (double)mem_peak_heapsize();
+    stats->live = total_size;
+    stats->heap_before = mem_heapsize();
+    mm_compact();
+    stats->heap_after = mem_heapsize();
+    return 1;
 }
 
+/*
+ * same_fill - Returns nonzero if the "size" bytes at "p" all hold the low
+ *   byte of "index", as the replay left them
+ */
+static int same_fill(const char *p, unsigned size, int index)
+{
+    unsigned j;
+
+    for (j = 0; j < size; j++)
+	if ((unsigned char)p[j] != (index & 0xFF))
+	    return 0;
+    return 1;
+}
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -750,27 +2098,34 @@ static void eval_mm_speed(void *ptr)
     unsigned i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    struct lathist *lat = ((speed_t *)ptr)->lat;
+    uint64_t start = 0;
+    traceop_t op;
+    cursor_t cur;
 
     /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
+    if (reset_heap() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    start_ops(trace, &cur);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	next_op(&cur, &op);
+	if (lat != NULL)
+	    start = read_counter();
+        switch (op.type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op.index;
+            size = op.size;
             if ((p = mm_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+	    index = op.index;
+            newsize = op.size;
 	    oldp = trace->blocks[index];
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
@@ -778,7 +2133,7 @@ static void eval_mm_speed(void *ptr)
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op.index;
             block = trace->blocks[index];
             mm_free(block);
             break;
@@ -786,6 +2141,9 @@ static void eval_mm_speed(void *ptr)
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+	if (lat != NULL)
+	    lathist_record(&lat[op.type], read_counter() - start);
+    }
 }
 
 /*************************************
@@ -799,27 +2157,43 @@ static void eval_mm_speed(void *ptr)
 static void printresults(int n, stats_t *stats) 
 {
     int i;
+    int spread = 0;  /* print the spread of the timed runs? */
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double var = 0;
+
+    for (i=0; i < n; i++)
+	if (stats[i].valid && stats[i].spread.runs > 0)
+	    spread = 1;
 
     /* Print the individual results for each trace */
     /* All the space before the last number on each line is added by 
      * Zheng Cai, for better formatting */
-    printf("%5s%7s %5s%8s%10s %6s\n", 
+    printf("%5s%7s %5s%8s%10s %6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (spread)
+	printf("%10s %6s %4s", "mad", "ci", "runs");
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f %6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f %6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (spread)
+		printf("%10.6f %5.1f%% %4d",
+		       stats[i].spread.mad,
+		       stats[i].spread.ci/stats[i].secs*100.0,
+		       stats[i].spread.runs);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    var += stats[i].spread.ci * stats[i].spread.ci;
 	}
 	else {
 	    printf("%2d%10s%6s%8s%10s %6s\n", 
@@ -834,12 +2208,15 @@ static void printresults(int n, stats_t *stats)
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f %6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f %6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	if (spread)  /* the traces' intervals add in quadrature */
+	    printf("%10s %5.1f%%", "", sqrt(var)/secs*100.0);
+	printf("\n");
     }
     else {
 	printf("%12s%6s%8s%10s %6s\n", 
@@ -852,6 +2229,88 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printmmstats - prints the allocator's counters for each trace, with
+ *     histograms of find_fit's search lengths.  With -V, also prints
+ *     the fit hits, free bytes, and heap extensions of each nonempty bin,
+ *     the first requests that extended the heap, and the longest searches.
+ */
+static void printmmstats(int n, stats_t *stats)
+{
+    int i, b;
+    size_t fits;
+    struct mm_stats *st;
+
+    printf("%5s%8s%7s%7s%20s%6s%8s%8s%8s%6s\n",
+	   "trace", "fits", "miss", "split", "coalesce 1/2/3/4", "ext",
+	   "heapKB", "liveKB", "maxfKB", "frag");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	st = &stats[i].mm;
+	for (b = 0, fits = 0; b < MM_NBINS; b++)
+	    fits += st->fit_hits[b];
+	printf("%2d%11zu%7zu%7zu %4zu/%4zu/%4zu/%4zu%6zu%8zu%8zu%8zu%5.0f%%\n",
+	       i, fits, st->fit_misses, st->splits,
+	       st->coalesces[0], st->coalesces[1], st->coalesces[2],
+	       st->coalesces[3], st->extends, st->heap_bytes / 1024,
+	       st->live_bytes / 1024, st->largest_free / 1024,
+	       st->frag * 100.0);
+	printhist("nodes", st->fit_nodes);
+	printhist("bins", st->fit_bins);
+	if (st->steals > 0)
+	    printf("%13s: %zu\n", "steals", st->steals);
+	if (st->quick_hits > 0 || st->quick_frees > 0)
+	    printf("%13s: %zu hits, %zu frees\n", "quick",
+		   st->quick_hits, st->quick_frees);
+	if (stats[i].pressure > 0)
+	    printf("%13s: %zu pressure events, %zu ballast blocks shed\n",
+		   "budget", stats[i].pressure, stats[i].shed);
+	if (st->deferred_frees > 0 || st->trim_bytes > 0)
+	    printf("%13s: %zu deferred frees, %zu bytes trimmed\n",
+		   "maintenance", st->deferred_frees, st->trim_bytes);
+	if (verbose > 1) {
+	    for (b = 0; b < MM_NBINS; b++)
+		if (st->fit_hits[b] > 0 || st->free_bytes[b] > 0 ||
+		    st->extend_bins[b] > 0)
+		    printf("%13s %2d: %zu fits, %zu extends, %zu bytes free\n",
+			   "bin", b, st->fit_hits[b], st->extend_bins[b],
+			   st->free_bytes[b]);
+	    printslow("first extends", st->first_extends);
+	    printslow("longest fits", st->longest_fits);
+	}
+    }
+}
+
+/*
+ * printhist - prints the nonempty buckets of a find_fit histogram, each
+ *     labeled with the smallest count it holds
+ */
+static void printhist(char *name, size_t *hist)
+{
+    int b;
+
+    printf("%13s:", name);
+    for (b = 0; b < MM_HIST; b++)
+	if (hist[b] > 0)
+	    printf(" %lu%s:%zu", b == 0 ? 0 : 1UL << (b - 1),
+		   b == MM_HIST - 1 ? "+" : "", hist[b]);
+    printf("\n");
+}
+
+/*
+ * printslow - prints a list of slow requests
+ */
+static void printslow(char *name, struct mm_slow_op *slow)
+{
+    int i;
+
+    printf("%13s:\n", name);
+    for (i = 0; i < MM_NSLOW && slow[i].size > 0; i++)
+	printf("%15s op %zu, size %zu: %u nodes in %u bins\n", "",
+	       slow[i].op, slow[i].size, slow[i].nodes, slow[i].bins);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -879,18 +2338,182 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * printhandles - prints, for each trace, the utilization of the plain and
+ *     the movable-handle replays, and the live bytes and heap size at the
+ *     end of the handle replay, before and after mm_compact.
+ */
+static void printhandles(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%9s%9s%6s%9s%6s\n", "trace", "util", "handles",
+	   "liveKB", "heapKB", "util", "compKB", "util");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d%9.0f%%%8.0f%%%9zu%9zu%5.0f%%%9zu%5.0f%%\n",
+	       i, stats[i].util * 100.0, stats[i].hutil * 100.0,
+	       stats[i].live / 1024, stats[i].heap_before / 1024,
+	       100.0 * stats[i].live / stats[i].heap_before,
+	       stats[i].heap_after / 1024,
+	       100.0 * stats[i].live / stats[i].heap_after);
+    }
+}
+
+/*
+ * printlatency - print the latency percentiles of each request type of
+ *     each trace timed with -l, of all its requests, and of each type
+ *     over all the traces
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static char *names[] = {"malloc", "free", "realloc", "all"};
+    struct lathist all, total[4];
+    struct lathist *h;
+    double ns = 1e9 / counter_hz();
+    int i, t;
+
+    for (t = 0; t < 4; t++)
+	lathist_reset(&total[t]);
+    printf("%5s  %-8s%10s%8s%8s%8s%8s%10s\n",
+	   "trace", "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i <= n; i++) {
+	if (i < n && stats[i].lat == NULL)
+	    continue;
+	lathist_reset(&all);
+	for (t = 0; t < 4; t++) {
+	    if (i == n)
+		h = &total[t];
+	    else if (t < 3) {
+		h = &stats[i].lat[t];
+		lathist_merge(&all, h);
+		lathist_merge(&total[t], h);
+	    } else {
+		h = &all;
+		lathist_merge(&total[t], h);
+	    }
+	    if (h->count == 0)
+		continue;
+	    if (i < n)
+		printf("%2d%5s", i, "");
+	    else
+		printf("%-7s", "Total");
+	    printf("%-8s%10llu%8.0f%8.0f%8.0f%8.0f%10.0f\n", names[t],
+		   (unsigned long long)h->count,
+		   lathist_percentile(h, 50) * ns,
+		   lathist_percentile(h, 90) * ns,
+		   lathist_percentile(h, 99) * ns,
+		   lathist_percentile(h, 99.9) * ns, h->max * ns);
+	}
+    }
+}
+
+/*
+ * printcounters - print the events counted with -e per op of each trace,
+ *     and instructions per cycle if both were counted
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    uint64_t total[PERFCTR_MAX];
+    double ops = 0;
+    uint64_t *c;
+    int i, j, ipc = (counters.cycles >= 0 && counters.instrs >= 0);
+
+    memset(total, 0, sizeof(total));
+    printf("%5s", "trace");
+    for (j = 0; j < counters.n; j++)
+	printf("%11s", counters.name[j]);
+    printf(ipc ? "%6s\n" : "\n", "IPC");
+    for (i = 0; i <= n; i++) {
+	if (i < n) {
+	    if (!stats[i].valid)
+		continue;
+	    c = stats[i].counts;
+	    ops += stats[i].ops;
+	    for (j = 0; j < counters.n; j++)
+		total[j] += c[j];
+	    printf("%2d%3s", i, "");
+	} else {
+	    c = total;
+	    printf("%-5s", "Total");
+	}
+	for (j = 0; j < counters.n; j++)
+	    printf("%11.2f", c[j] / ((i < n) ? stats[i].ops : ops));
+	if (ipc)
+	    printf("%6.2f", c[counters.cycles] == 0 ? 0 :
+		   (double)c[counters.instrs] / c[counters.cycles]);
+	printf("\n");
+    }
+}
+
+#ifdef MM_CACHESIM
+/*
+ * printcache - print the simulated line accesses and cache misses per op
+ *     of each trace, and the share of accesses that missed the L1
+ */
+static void printcache(int n, stats_t *stats)
+{
+    struct cachesim_stats total, *c;
+    double ops = 0, o;
+    int i;
+
+    memset(&total, 0, sizeof(total));
+    printf("%5s%11s%11s%11s%9s\n", "trace", "lines", "L1-miss", "L2-miss",
+	   "L1-miss%");
+    for (i = 0; i <= n; i++) {
+	if (i < n) {
+	    if (!stats[i].valid)
+		continue;
+	    c = &stats[i].cache;
+	    o = stats[i].ops;
+	    ops += o;
+	    total.accesses += c->accesses;
+	    total.l1_misses += c->l1_misses;
+	    total.l2_misses += c->l2_misses;
+	    printf("%2d%3s", i, "");
+	} else {
+	    c = &total;
+	    o = ops;
+	    printf("%-5s", "Total");
+	}
+	printf("%11.2f%11.3f%11.3f%9.2f\n", c->accesses / o,
+	       c->l1_misses / o, c->l2_misses / o, c->accesses == 0 ? 0 :
+	       100.0 * c->l1_misses / c->accesses);
+    }
+}
+#endif
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-aghvV] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-aACeghHlSvV] [-b <bytes>] [-c <blocks>] [-f <file>] [-j <n>] [-m <size>]\n\t       [-M <ms>] [-p <bytes>] [-P <file>] [-t <dir>] [-T <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A         Align huge-page-sized blocks to huge pages.\n");
+    fprintf(stderr, "\t-b <bytes> Check each trace with the heap capped at <bytes>,\n");
+    fprintf(stderr, "\t           half of it first taken by blocks freed on demand.\n");
+    fprintf(stderr, "\t-c <n>     Check n heap blocks per op while validating.\n");
+    fprintf(stderr, "\t-C         Also replay each trace through movable handles, then\n");
+    fprintf(stderr, "\t           compact the heap.\n");
+    fprintf(stderr, "\t-e         Count hardware events per op (software events if none).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Back the heap with transparent huge pages.\n");
+    fprintf(stderr, "\t-j <n>     Check up to n traces at once in worker processes.\n");
+    fprintf(stderr, "\t-l         Print request latency percentiles.\n");
+    fprintf(stderr, "\t-m <size>  Maximum heap size in bytes (K, M, G suffixes ok).\n");
+    fprintf(stderr, "\t-M <ms>    Run mm's maintenance thread every <ms> ms (THREADS=1).\n");
+    fprintf(stderr, "\t-p <bytes> Heap profile sampling interval (default 512K).\n");
+    fprintf(stderr, "\t-P <file>  Dump the heap profile to <file> (folded stacks\n");
+    fprintf(stderr, "\t           if it ends in .folded, else pprof).\n");
+    fprintf(stderr, "\t-S         Stream each trace from its file instead of loading it\n");
+    fprintf(stderr, "\t           (timings then include reading it).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <file>  Dump the allocator event trace to <file>.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -2,6 +2,18 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The heap is an address range reserved with mmap but not backed by any
+ * memory.  Pages are made accessible as mem_sbrk first reaches them, so
+ * the size of the reservation costs nothing until it is used.  The
+ * reservation defaults to MAX_HEAP bytes; the MEM_MAX_HEAP environment
+ * variable overrides it with a byte count, optionally suffixed with K, M,
+ * or G.
+ *
+ * If the MEM_HUGEPAGES environment variable is set to a nonzero value, the
+ * reservation is aligned to a huge page, marked for transparent huge pages,
+ * and made accessible a whole huge page at a time so that the kernel can
+ * back it with huge pages.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,28 +22,71 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <limits.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* size of an x86-64 or AArch64 (4 KB granule) transparent huge page */
+#define HUGEPAGE_SIZE (1 << 21)
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_peak_brk;   /* highest value mem_brk has reached */
+static char *mem_commit_brk; /* end of the accessible part of the heap */
+static size_t mem_commit_unit; /* granularity of making the heap accessible */
+
+/* function prototypes */
+static size_t mem_max_heap(void);
+static int mem_use_hugepages(void);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    size_t max_heap = mem_max_heap();
+    size_t align = mem_pagesize();
+    char *base;
+
+    /* huge pages need a huge page aligned, huge page sized reservation */
+    mem_commit_unit = mem_pagesize();
+    if (mem_use_hugepages()) {
+	align = mem_hugepagesize();
+	max_heap = (max_heap + align - 1) & ~(align - 1);
+	mem_commit_unit = align;
+    }
+
+    /* reserve the address range we will use to model the available VM */
+    base = mmap(NULL, max_heap + align - mem_pagesize(), PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error: %s\n", strerror(errno));
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    /* trim the reservation to an aligned range of max_heap bytes */
+    mem_start_brk = (char *)(((uintptr_t)base + align - 1) & ~(align - 1));
+    if (mem_start_brk > base)
+	munmap(base, (size_t)(mem_start_brk - base));
+    if (align > mem_pagesize())
+	munmap(mem_start_brk + max_heap,
+	       (size_t)(base + max_heap + align - mem_pagesize() -
+			(mem_start_brk + max_heap)));
+#ifdef MADV_HUGEPAGE
+    if (align > mem_pagesize() &&
+	madvise(mem_start_brk, max_heap, MADV_HUGEPAGE) < 0)
+	fprintf(stderr, "mem_init_vm: madvise(MADV_HUGEPAGE): %s\n",
+		strerror(errno));
+#endif
+
+    mem_max_addr = mem_start_brk + max_heap;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_peak_brk = mem_start_brk;
+    mem_commit_brk = mem_start_brk;           /* nothing is accessible yet */
 }
 
 /* 
@@ -39,7 +94,7 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, (size_t)(mem_max_addr - mem_start_brk));
 }
 
 /*
@@ -48,26 +103,92 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     mem_brk = mem_start_brk;
+    mem_peak_brk = mem_start_brk;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, but never below its first byte,
+ *    and gives whole commit units past the new end back to the OS.  Those
+ *    stay accessible, so mem_commit_brk only grows.
  */
 void *mem_sbrk(intptr_t incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((incr < 0) && (-incr > mem_brk - mem_start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Heap cannot shrink below its start...\n");
+	return (void *)-1;
+    }
+    if ((incr > 0) && (incr > mem_max_addr - mem_brk)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
+
+    /* make any newly reached pages accessible */
+    if (mem_brk + incr > mem_commit_brk) {
+	char *new_commit = mem_start_brk +
+	    ((mem_brk + incr - mem_start_brk + mem_commit_unit - 1) &
+	     ~(mem_commit_unit - 1));
+
+	if (new_commit > mem_max_addr)
+	    new_commit = mem_max_addr;
+	if (mprotect(mem_commit_brk, (size_t)(new_commit - mem_commit_brk),
+		     PROT_READ | PROT_WRITE) < 0) {
+	    fprintf(stderr, "ERROR: mem_sbrk failed. mprotect: %s\n",
+		    strerror(errno));
+	    errno = ENOMEM;
+	    return (void *)-1;
+	}
+	mem_commit_brk = new_commit;
+    }
+    /*
+     * Give back any pages the heap no longer reaches.  They stay mapped
+     * and accessible, reading as zero, since mm may still read a stale
+     * link in a block it has just trimmed.
+     */
+    if (incr < 0) {
+	char *lo = mem_start_brk +
+	    ((mem_brk + incr - mem_start_brk + mem_commit_unit - 1) &
+	     ~(mem_commit_unit - 1));
+	char *hi = mem_start_brk +
+	    ((mem_brk - mem_start_brk + mem_commit_unit - 1) &
+	     ~(mem_commit_unit - 1));
+
+	if (lo < hi && madvise(lo, (size_t)(hi - lo), MADV_DONTNEED) < 0)
+	    fprintf(stderr, "ERROR: mem_sbrk could not release pages: %s\n",
+		    strerror(errno));
+    }
     mem_brk += incr;
+    if (mem_brk > mem_peak_brk)
+	mem_peak_brk = mem_brk;
     return (void *)old_brk;
 }
 
+/*
+ * mem_purge - give the pages wholly inside [addr, addr + len) back to the
+ *    OS.  They stay part of the heap and read as zero when next touched.
+ *    Returns the number of bytes given back.
+ */
+size_t mem_purge(void *addr, size_t len)
+{
+    uintptr_t pagesize = mem_pagesize();
+    char *lo = (char *)(((uintptr_t)addr + pagesize - 1) & ~(pagesize - 1));
+    char *hi = (char *)(((uintptr_t)addr + len) & ~(pagesize - 1));
+
+    if (hi <= lo)
+	return 0;
+    if (madvise(lo, (size_t)(hi - lo), MADV_DONTNEED) < 0) {
+	fprintf(stderr, "ERROR: mem_purge failed. madvise: %s\n",
+		strerror(errno));
+	return 0;
+    }
+    return (size_t)(hi - lo);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -92,6 +213,15 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes since
+ *    the last mem_init or mem_reset_brk
+ */
+size_t mem_peak_heapsize() 
+{
+    return (size_t)(mem_peak_brk - mem_start_brk);
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -99,3 +229,59 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_hugepagesize() - returns the size of a transparent huge page
+ */
+size_t mem_hugepagesize()
+{
+    return (size_t)HUGEPAGE_SIZE;
+}
+
+/*
+ * mem_max_heap - returns the size of the heap reservation in bytes: the
+ *    value of MEM_MAX_HEAP if it is set, and MAX_HEAP otherwise
+ */
+static size_t mem_max_heap(void)
+{
+    char *spec = getenv("MEM_MAX_HEAP");
+    char *end;
+    unsigned long long bytes;
+    int shift = 0;
+
+    if (spec == NULL || *spec == '\0')
+	return (size_t)MAX_HEAP;
+    errno = 0;
+    bytes = strtoull(spec, &end, 10);
+    switch (*end) {
+    case 'G': case 'g':
+	shift += 10;
+	/* fall through */
+    case 'M': case 'm':
+	shift += 10;
+	/* fall through */
+    case 'K': case 'k':
+	shift += 10;
+	end++;
+	break;
+    }
+    if (bytes > (ULLONG_MAX >> shift))
+	errno = ERANGE;
+    bytes <<= shift;
+    if (errno != 0 || end == spec || *end != '\0' || bytes == 0 ||
+	bytes > SIZE_MAX || spec[strspn(spec, " \t")] == '-') {
+	fprintf(stderr, "mem_init_vm: bad MEM_MAX_HEAP value \"%s\"\n", spec);
+	exit(1);
+    }
+    return (size_t)bytes;
+}
+
+/*
+ * mem_use_hugepages - returns whether MEM_HUGEPAGES asks for huge pages
+ */
+static int mem_use_hugepages(void)
+{
+    char *spec = getenv("MEM_HUGEPAGES");
+
+    return (spec != NULL && *spec != '\0' && strcmp(spec, "0") != 0);
+}
@@ -12,15 +12,26 @@
  * type uintptr_t to define unsigned integers that are the same size
  * as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
  */
+#ifdef MM_THREADS
+#define _GNU_SOURCE  /* For PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
+#endif
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#endif
 
+#include "cachesim.h"
 #include "memlib.h"
 #include "mm.h"
+#include "mmprof.h"
+#include "mmtrace.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -50,13 +61,35 @@ team_t team = {
 /* Pack a size and allocated bit into a word. */
 #define PACK(size, alloc)  ((size) | (alloc))
 
-/* Read and write a word at address p. */
-#define GET(p)       (*(uintptr_t *)(p))
-#define PUT(p, val)  (*(uintptr_t *)(p) = (val))
+/* Header/footer bit marking an allocated block that mm_compact may move. */
+#define MOVABLE  0x2
+
+/* Header/footer bit marking a block, free or not, in the long-lived region. */
+#define LONG_LIVED  0x4
+
+/*
+ * Read and write a word at address p.  In cache simulator builds (make
+ * CACHESIM=1), WORD reports the access first, evaluating p only once.
+ */
+#ifdef MM_CACHESIM
+static inline uintptr_t *
+touch_word(void *p)
+{
+	CACHE_TOUCH(p, WSIZE);
+	return ((uintptr_t *)p);
+}
+#define WORD(p)      (*touch_word(p))
+#else
+#define WORD(p)      (*(uintptr_t *)(p))
+#endif
+#define GET(p)       WORD(p)
+#define PUT(p, val)  (WORD(p) = (val))
 
 /* Read the size and allocated fields from address p. */
 #define GET_SIZE(p)   (GET(p) & ~(DSIZE - 1))
 #define GET_ALLOC(p)  (GET(p) & 0x1)
+#define GET_MOVABLE(p)  (GET(p) & MOVABLE)
+#define GET_REGION(p)   (GET(p) & LONG_LIVED)
 
 /* Given block ptr bp, compute address of its header and footer. */
 #define HDRP(bp)  ((char *)(bp) - WSIZE)
@@ -67,18 +100,26 @@ team_t team = {
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
 /*Given a size, return pointer to index for given size range in freeList */
-#define GET_INDEX(size) ((size) == (0) ? (-1) : (size) < (3) ? (0) : (size) < (5) ? (1) : (size) < (9) ? (2) : (size) < (17) ? (3) : (size) < (33) ? (4) : (size) < (65) ? (5) : (size) < (129) ? (6) : (size) < (257) ? (7) : (size) < (513) ? (8) : (size) < (1025) ? (9) : (size) < (2049) ? (10) : (size) < (4096) ? (11) : (size) < (8192) ? (12) : (size) < (16385) ? (13) : (size) < (32768) ? (14) : (size) < (65536) ? (15) : (size) < (131073) ? (16) : (size) < (262145) ? (17) : (size) < (524289) ? (18) : (size) < (1048577) ? (19) : (size) < (2097153) ? (20) : (size) < (4194305) ? (21) : (size) < (8388609) ? (22) : (size) < (16777217) ? (23) : (size) < (33554433) ? (24) : (size) < (67108865) ? (25) : (26))
+#define GET_INDEX(size) ((size) == (0) ? (-1) : (size) < (3) ? (0) : (size) < (5) ? (1) : (size) < (9) ? (2) : (size) < (17) ? (3) : (size) < (33) ? (4) : (size) < (65) ? (5) : (size) < (129) ? (6) : (size) < (257) ? (7) : (size) < (513) ? (8) : (size) < (1025) ? (9) : (size) < (2049) ? (10) : (size) < (4096) ? (11) : (size) < (8192) ? (12) : (size) < (16385) ? (13) : (size) < (32768) ? (14) : (size) < (65536) ? (15) : (size) < (131073) ? (16) : (size) < (262145) ? (17) : (size) < (524289) ? (18) : (size) < (1048577) ? (19) : (size) < (2097153) ? (20) : (size) < (4194305) ? (21) : (size) < (8388609) ? (22) : (size) < (16777217) ? (23) : (size) < (33554433) ? (24) : (25))
 //#define GET_INDEX(size) ceil(log(size)/log(2));
 //#define GET_INDEX(size) ceil((float)size/100.0);
 /* Global variables: */
 static char *heap_listp; /* Pointer to first block */  
 
+/*
+ * A free block's payload starts with its list links and a copy of its
+ * size, so that walking a list touches one cache line per node.  Blocks
+ * of the minimum size have no room for the copy (it would overlap their
+ * footer) and do not need it: their bin holds no other size.
+ */
 struct freeBlock{
 		struct freeBlock *prev;
 		struct freeBlock *next;		
-		
+		size_t size;
 };
 
+#define MIN_INDEX  GET_INDEX(2 * DSIZE)   /* Bin of minimum-size blocks */
+
 
 //static int *free_list[5];
 //static int (*free_lis);
@@ -89,22 +130,318 @@ struct freeBlock{
 //we're going to initialize a struct that contains pointers to the next and prev structs
 
 
-struct freeBlock *array_heads;
+/*
+ * A dummy head is only ever used for its links, so it takes just the
+ * first two words of a struct freeBlock.  HEAD(i) is the i-th head.
+ */
+struct freeHead {
+		struct freeBlock *prev;
+		struct freeBlock *next;
+};
+
+struct freeHead *array_heads;
+
+/*
+ * The long-lived region's heads live in an allocated block that is made
+ * the first time a block is placed in that region (see make_long_heads),
+ * so that a heap without long-lived blocks pays for one set of heads
+ * only.  Until then they are the empty heads in unmade_heads.
+ */
+static struct freeHead *long_heads;
+static struct freeHead unmade_heads[MM_NBINS];
+
+#define HEAD(i)  ((struct freeBlock *)((i) < free_list_size ? \
+	&array_heads[(i)] : &long_heads[(i) - free_list_size]))
+
+/* Tell the cache simulator that free list node "fb" is read or written. */
+#define TOUCH_NODE(fb)  CACHE_TOUCH((fb), sizeof(struct freeBlock))
+#define TOUCH_HEAD(fb)  CACHE_TOUCH((fb), sizeof(struct freeHead))
+
+int free_list_size = MM_NBINS;
+
+/*
+ * Each region has its own free_list_size dummy heads, the short-lived
+ * region's in array_heads and the long-lived region's in long_heads.
+ * "region" is the header's LONG_LIVED bit.  Free blocks of different
+ * regions still coalesce (see coalesce), so a region says where a block
+ * is preferably placed, not where it may go.
+ */
+#define REGION_HEAD(region, index) \
+	HEAD(((region) ? free_list_size : 0) + (index))
+
+/*
+ * Unhinted requests are classified per size class from the allocations
+ * and frees seen so far: once a class has had LIFETIME_MIN allocations, it
+ * goes to the long-lived region if fewer than one in LIFETIME_RATIO of
+ * them has been freed, but only while the program as a whole frees at
+ * least that often.  While a program ramps up, few of its blocks have had
+ * a chance to be freed, and no class is singled out.  The counts are
+ * halved every LIFETIME_WINDOW allocations so the classification can
+ * follow phase changes.
+ */
+#define LIFETIME_MIN     64
+#define LIFETIME_RATIO   4
+#define LIFETIME_WINDOW  4096
+
+static unsigned int class_allocs[MM_NBINS];  /* Allocations per class */
+static unsigned int class_frees[MM_NBINS];   /* Frees per class */
+static unsigned int all_allocs, all_frees;   /* The same for all classes */
+
+/*
+ * A short-lived request that finds no fit takes a free block from the
+ * long-lived region before growing the heap, so that the heap does not
+ * grow while that region sits on free memory.  The search visits at most
+ * STEAL_SCAN free list nodes.  Long-lived requests never steal: a
+ * long-lived block in the short-lived region would pin the free space
+ * around it.
+ */
+#define STEAL_SCAN  32
+
+/* If true, blocks of a huge page or more start on a huge page boundary. */
+static bool huge_align;
+
+/*
+ * With a nonzero budget, the heap may not grow past "budget" bytes.  An
+ * allocation that would grow it past the budget first relieves the
+ * pressure, as budget_fit describes, and calls pressure_cb, at most
+ * PRESSURE_TRIES times, before giving up.
+ */
+#define PRESSURE_TRIES  4
+
+static size_t budget;                /* Heap size limit, or 0 */
+static mm_pressure_fn pressure_cb;   /* Called when over budget, or NULL */
+
+/*
+ * Free blocks of at least PURGE_MIN bytes record in STAMP the op_clock
+ * value at which they entered a free list.  Every PURGE_PERIOD operations,
+ * purge_free gives the interior pages of those that have sat unused for
+ * PURGE_DECAY operations back to the OS and marks them PURGED.  Purged
+ * blocks are kept at the tail of their bin, so find_fit reuses resident
+ * blocks first.  PURGE_EDGE is the first purged block of a bin, or its
+ * head if it has none; the blocks in front of it are newest first, so the
+ * oldest resident block is the one just before it.
+ */
+#define PURGE_MIN     (1 << 16)
+#define PURGE_PERIOD  1024
+#define PURGE_DECAY   4096
+#define PURGE_SCAN    64     /* Most free blocks purge_free looks at */
+#define PURGED        (~(uintptr_t)0)
+
+#define STAMP(bp)  WORD((char *)(bp) + sizeof(struct freeBlock))
+
+static struct freeBlock *purge_edge[2 * MM_NBINS]; /* By head, as HEAD(i) */
+#define PURGE_EDGE(region, index) \
+	purge_edge[((region) ? free_list_size : 0) + (index)]
+
+static uintptr_t op_clock;         /* mm_malloc and mm_free calls so far */
+static uintptr_t next_purge;       /* op_clock value of the next purge */
+
+/* Free list nodes visited and bins scanned by the last find_fit call. */
+static unsigned int fit_search;
+static unsigned int fit_bins;
+
+/*
+ * Counters behind mm_get_stats, kept on cache lines of their own.  Only
+ * the counts and free_bytes are maintained as the heap changes; the rest
+ * is computed by mm_get_stats.
+ */
+static struct mm_stats stats __attribute__((aligned(64)));
+
+/*
+ * The incremental checker checks check_window blocks per operation,
+ * starting from check_cursor, which is always NULL or the address of a
+ * block.  Coalescing moves it to the start of the merged block.
+ */
+static int check_window;           /* Blocks checked per operation, or 0 */
+static char *check_cursor;         /* Next block to check, or NULL */
+static int check_next_head;        /* Dummy head checked last */
+
+#define CHECK_ABSORB(gone, into) do {					\
+	if (check_cursor == (char *)(gone))				\
+		check_cursor = (char *)(into);				\
+} while (0)
+
+#ifdef MM_THREADS
+/*
+ * In threaded builds (make THREADS=1), one recursive mutex guards the heap.
+ * Blocks of up to QUICK_MAX bytes bypass it: they are freed into and
+ * allocated from quick bins, one lock-free stack per block size and
+ * region.  A stack's top word packs the offset of its first block from
+ * quick_base, in DSIZE units (0 if empty), with a tag that every push and
+ * pop increments, so that a pop racing with others fails its
+ * compare-and-swap instead of installing a stale link.  Each block links
+ * to the next through its first payload word.  An offset must fit in 32
+ * bits, so blocks more than QUICK_SPAN bytes past quick_base never go in
+ * a quick bin.  Unhinted allocations try the short-lived region's bin
+ * first and then the long-lived one's.  Blocks in quick bins stay
+ * marked allocated, so they are not coalesced until flush_parked gives
+ * them back to the free lists, which it does before the heap would grow.
+ * Trimming the heap gives its pages back but leaves them mapped and
+ * readable (see mem_sbrk), so a stale link read by a losing pop is always
+ * safe to read, even if its block has since been trimmed away.
+ *
+ * While the heap profiler is on, every operation takes the lock, because
+ * the profiler's tables are not thread-safe.
+ *
+ * While the maintenance thread runs (mm_start_maintenance), frees that
+ * miss the quick bins push the block onto the deferred queue, another
+ * lock-free stack linked the same way, and return at once.  The thread
+ * frees the queued blocks every maint_period milliseconds, or sooner once
+ * DEFER_WAKE are waiting.  It takes the whole queue at once, so unlike a
+ * quick bin pop it cannot be fooled by a reused address.  After a period
+ * with no other activity, it also flushes the quick bins, purges, and
+ * trims a free block of at least TRIM_MIN bytes from the end of the heap.
+ */
+#define QUICK_MAX  256                    /* Largest block in a quick bin */
+#define NQUICK     ((int)(QUICK_MAX / DSIZE) - 1) /* Bins per region */
+#define QUICK_CAP  64                     /* Blocks per quick bin, roughly */
+#define QUICK_OFF(top)  ((top) & 0xffffffff)
+#define QUICK_SPAN ((uint64_t)0xffffffff * DSIZE) /* Reach of an offset */
+#define QUICK_TOP(top, off)  ((((top) >> 32) + 1) << 32 | (off))
+
+struct quick_bin {
+	_Atomic uint64_t top;              /* Tag and offset of first block */
+	atomic_uint count;                 /* Blocks, never an undercount */
+} __attribute__((aligned(64)));
+
+static struct quick_bin quick_bins[2][NQUICK]; /* By region and size */
+static char *quick_base;                   /* Address of offset 0 */
+static atomic_bool quick_off;              /* True while profiling */
+static size_t prof_interval;               /* Last mm_prof_set_interval */
+
+#define DEFER_WAKE  1024                  /* Queued blocks that wake it */
+#define TRIM_MIN    (1 << 16)             /* Smallest idle trim */
+
+static _Atomic(char *) deferred;           /* First queued block */
+static atomic_uint deferred_count;         /* Blocks queued */
+static atomic_bool maint_on;               /* True while the thread runs */
+static atomic_bool maint_kicked;           /* True once woken to drain */
+static unsigned int maint_period;          /* Milliseconds between passes */
+static pthread_t maint_thread;
+static pthread_mutex_t maint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_wake = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Fast path counters, one cache line per thread.  A thread beyond the
+ * first NCOUNTS shares a line, so its counts may lose an increment.
+ */
+#define NCOUNTS  64
+
+struct thread_counts {
+	atomic_size_t quick_hits;
+	atomic_size_t quick_frees;
+	atomic_size_t deferred_frees;
+} __attribute__((aligned(64)));
+
+static struct thread_counts thread_counts[NCOUNTS];
+static atomic_uint next_counts;            /* Threads given counters */
+static _Thread_local struct thread_counts *my_counts;
+
+#define COUNT(field) do {						\
+	if (my_counts == NULL)						\
+		my_counts = &thread_counts[atomic_fetch_add(&next_counts, 1) % \
+		    NCOUNTS];						\
+	atomic_store_explicit(&my_counts->field,			\
+	    atomic_load_explicit(&my_counts->field,			\
+	    memory_order_relaxed) + 1, memory_order_relaxed);		\
+} while (0)
+
+static pthread_mutex_t heap_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+#define HEAP_LOCK()    pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK()  pthread_mutex_unlock(&heap_lock)
+
+/*
+ * The quick paths tally their allocations and frees for the lifetime
+ * classifier per thread.  fold_counts adds a thread's tallies to the
+ * shared counts whenever the thread takes the heap lock, and TALLY has it
+ * do so as soon as FOLD_EVERY are pending if the lock is free.  Tallies
+ * begun before the last mm_init are dropped.
+ */
+#define NQCLASS     (GET_INDEX(QUICK_MAX) + 1) /* Classes of quick blocks */
+#define FOLD_EVERY  64
+
+static atomic_uint class_epoch;            /* mm_init calls */
+static _Thread_local unsigned int my_allocs[NQCLASS], my_frees[NQCLASS];
+static _Thread_local unsigned int my_unfolded;    /* Tallies pending */
+static _Thread_local unsigned int my_epoch;       /* class_epoch of them */
+
+#define TALLY(tallies, asize) do {					\
+	if (my_unfolded == 0)						\
+		my_epoch = atomic_load_explicit(&class_epoch,		\
+		    memory_order_relaxed);				\
+	tallies[GET_INDEX(asize)]++;					\
+	if (++my_unfolded >= FOLD_EVERY &&				\
+	    pthread_mutex_trylock(&heap_lock) == 0) {			\
+		fold_counts();						\
+		HEAP_UNLOCK();						\
+	}								\
+} while (0)
+
+#define FOLD_COUNTS()  fold_counts()
+#else
+#define HEAP_LOCK()    ((void)0)
+#define HEAP_UNLOCK()  ((void)0)
+#define FOLD_COUNTS()  ((void)0)
+#endif
+
+/*
+ * A handle is an index into handle_table.  A slot in use holds the payload
+ * address of its movable block; a free slot holds the index of the next
+ * free slot.  Slot 0 is never handed out, so 0 terminates the free list
+ * and doubles as the failure value of mm_halloc.  The first word of every
+ * movable block records its owner: its handle, or 0 for the handle table,
+ * which is itself a movable block.
+ */
+#define HSLOTS  64                 /* Initial number of handle slots */
 
-int free_list_size = 26;
+static void **handle_table;        /* Handle slots, or NULL */
+static size_t handle_slots;        /* Number of slots in handle_table */
+static size_t free_slot;           /* First free slot, or 0 */
+static size_t handle_bytes;        /* Bytes in live movable blocks */
+static size_t freed_since_compact; /* Bytes freed since the last compaction */
 
 
 
 /* Function prototypes for internal helper routines: */
 static void *coalesce(void *bp);
-static void *extend_heap(size_t words);
-static void *find_fit(size_t asize);
+static void *extend_heap(size_t words, uintptr_t region);
+static void *find_fit(size_t asize, uintptr_t region);
+static void *steal_fit(size_t asize, uintptr_t region);
+static void *budget_fit(size_t asize, uintptr_t region);
+static uintptr_t classify(size_t asize);
+static void *alloc_block(size_t asize, uintptr_t region);
+static int make_long_heads(void);
+static void *huge_malloc(size_t asize, uintptr_t region);
+static void purge_free(void);
+static void free_block(void *bp);
+#ifdef MM_THREADS
+static void *quick_pop(size_t asize, uintptr_t region);
+static void fold_counts(void);
+static bool quick_push(void *bp);
+static void defer_push(void *bp);
+static size_t drain_deferred(void);
+static size_t flush_parked(void);
+static void *maint_main(void *arg);
+static size_t maint_activity(void);
+#endif
+static void count_fit(size_t asize);
+static void count_extend(size_t asize);
 static void place(void *bp, size_t asize);
 static void place_in_free_list(void* bp);
+static size_t compact_heap(bool trim);
+static size_t trim_heap(size_t min);
+static void *movable_malloc(size_t size, size_t owner);
+static void movable_free(void *ptr);
 
 /* Function prototypes for heap consistency checker routines: */
-static void checkblock(void *bp);
-static void checkheap(bool verbose);
+static bool is_head(void *p);
+static bool is_node(void *p);
+static bool size_ok(void *bp);
+static int checkblock(void *bp);
+static int check_head(int i);
+static int checkheap(bool verbose);
+static void check_step(void);
 static void printblock(void *bp);
 //static void print_free_list();
 static void remove_from_free_list(void* bp);
@@ -144,18 +481,25 @@ mm_init(void)
 	/* Create the initial empty heap. */
 	//leave some space for the array of dummy headers
 	//technically the space needed is (2 X WSIZE) for each of the freeblock heads
-	if ((array_heads = mem_sbrk(free_list_size * sizeof(struct freeBlock))) == (void *)-1) {
+	/* Keep a running maintenance thread out of the heap meanwhile. */
+	HEAP_LOCK();
+	memset(&stats, 0, sizeof(stats));
+	if ((array_heads = mem_sbrk(free_list_size * sizeof(struct freeHead))) == (void *)-1) {
+	    HEAP_UNLOCK();
 	    return (-1);
 	}
 	//create the dummy heads array -> each head points to itself
 	int i;
-    for(i = 0; i < free_list_size; i++) {
-        array_heads[i].prev = &array_heads[i];
-        array_heads[i].next = &array_heads[i];
+	long_heads = unmade_heads;
+    for(i = 0; i < 2 * free_list_size; i++) {
+        HEAD(i)->prev = HEAD(i);
+        HEAD(i)->next = HEAD(i);
+        purge_edge[i] = HEAD(i);
     }
 
 
 	if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1){
+		HEAP_UNLOCK();
 		return (-1);
 	}
 	PUT(heap_listp, 0);                            /* Alignment padding */
@@ -164,11 +508,57 @@ mm_init(void)
 	PUT(heap_listp + (3 * WSIZE), PACK(0, 1));     /* Epilogue header */
 	/*  We believe this is the pointer to the free memory address??*/
 	heap_listp += (2 * WSIZE);
+	stats.sbrk_bytes = mem_heapsize();
+
+	/* No handles exist yet. */
+	handle_table = NULL;
+	handle_slots = 0;
+	free_slot = 0;
+	handle_bytes = 0;
+	freed_since_compact = 0;
+
+	/* Checking starts over at the start of the heap. */
+	check_cursor = NULL;
+
+	/* Sampled blocks went with the old heap. */
+	mmprof_reset_live();
+
+#ifdef MM_THREADS
+	/* The quick bins start out empty. */
+	int r, q;
+	for (r = 0; r < 2; r++) {
+		for (q = 0; q < NQUICK; q++) {
+			atomic_store(&quick_bins[r][q].top, 0);
+			atomic_store(&quick_bins[r][q].count, 0);
+		}
+	}
+	for (i = 0; i < NCOUNTS; i++) {
+		atomic_store(&thread_counts[i].quick_hits, 0);
+		atomic_store(&thread_counts[i].quick_frees, 0);
+		atomic_store(&thread_counts[i].deferred_frees, 0);
+	}
+	atomic_store(&deferred, NULL);
+	atomic_store(&deferred_count, 0);
+	quick_base = mem_heap_lo();
+	atomic_store(&quick_off, prof_interval != 0);
+	atomic_fetch_add(&class_epoch, 1);
+#endif
+
+	/* Restart the purge schedule. */
+	op_clock = 0;
+	next_purge = PURGE_PERIOD;
+
+	/* Nothing is known about object lifetimes yet. */
+	memset(class_allocs, 0, sizeof(class_allocs));
+	memset(class_frees, 0, sizeof(class_frees));
+	all_allocs = all_frees = 0;
 
 	/* Extend the empty heap with a free block of CHUNKSIZE bytes. */
-	if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
+	if (extend_heap(CHUNKSIZE / WSIZE, 0) == NULL) {
+		HEAP_UNLOCK();
 		return (-1);
-
+	}
+	HEAP_UNLOCK();
 	return (0);
 }
 /* 
@@ -182,10 +572,26 @@ mm_init(void)
  */
 void *
 mm_malloc(size_t size) 
+{
+
+	return (mm_malloc_hint(size, 0));
+}
+
+/* 
+ * Requires:
+ *   "hint" is 0, MM_SHORT_LIVED, or MM_LONG_LIVED.
+ *
+ * Effects:
+ *   Like mm_malloc, but place the block in the heap region for objects of
+ *   the hinted lifetime.  If "hint" is 0, the region is chosen from the
+ *   lifetimes observed so far for blocks of this size.
+ */
+void *
+mm_malloc_hint(size_t size, int hint) 
 {
     //printf("Starting to malloc a block of size: %d\n", (int) size);
 	size_t asize;      /* Adjusted block size */
-	size_t extendsize; /* Amount to extend heap if no fit */
+	uintptr_t region;  /* LONG_LIVED or 0 */
 	void *bp;
 
 //	printf("The size we want to malloc is: %d\n", (int)size);
@@ -197,35 +603,52 @@ mm_malloc(size_t size)
 	/* Adjust block size to include overhead and alignment reqs. */
 	if (size <= DSIZE)
 	    asize = 2 * DSIZE;
-	//trying out 4
-//		asize = 2 * DSIZE;
-
-	else {
+	else
 	    asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
-//	    printf("Adjusted input size to asize: %d\n", (int) asize);
-
-	}
-
-	/* Search the free list for a fit. */
 
-	if ((bp = find_fit(asize)) != NULL) {
-		place(bp, asize);
-//		printf("finished malloc-ing with a block of adjusted size: %d\n", (int) asize);
-//		print_free_list();
-//		printf("This is the block returned to be malloc-ed: %p\n", bp);
+#ifdef MM_THREADS
+	/*
+	 * Small blocks come from a quick bin without the lock if possible,
+	 * from either region's if there is no hint.
+	 */
+	if (asize <= QUICK_MAX && !atomic_load_explicit(&quick_off,
+	    memory_order_relaxed) && ((bp = quick_pop(asize,
+	    (hint & MM_LONG_LIVED) ? LONG_LIVED : 0)) != NULL ||
+	    (hint == 0 && (bp = quick_pop(asize, LONG_LIVED)) != NULL))) {
+		COUNT(quick_hits);
+		TALLY(my_allocs, asize);
+		TRACE(MMT_MALLOC, size, bp, GET_INDEX(asize), 0);
 		return (bp);
 	}
-
-	/* No fit found.  Get more memory and place the block. */
-	extendsize = MAX(asize, CHUNKSIZE);
-	if ((bp = extend_heap(extendsize / WSIZE)) == NULL)  
-		return (NULL);
-		
-	place(bp, asize);
-//	printf("finished malloc-ing a block of adjusted size: %d\n", (int) asize);
-//	print_free_list();
-//	printf("This is the block returned to be malloc-ed: %p\n", bp);
-
+#endif
+	HEAP_LOCK();
+	FOLD_COUNTS();
+
+	/* Now and then, give long-unused large free blocks back to the OS. */
+	if (++op_clock == next_purge)
+		purge_free();
+
+	/* Pick the region, learning from every request's size. */
+	region = classify(asize);
+	if (hint & MM_LONG_LIVED)
+		region = LONG_LIVED;
+	else if (hint & MM_SHORT_LIVED)
+		region = 0;
+	if (region == LONG_LIVED && long_heads == unmade_heads &&
+	    make_long_heads() != 0)
+		region = 0;
+
+	/* Large blocks may be wanted on a huge page boundary. */
+	if (huge_align && asize >= mem_hugepagesize())
+		bp = huge_malloc(asize, region);
+	else
+		bp = alloc_block(asize, region);
+	if (bp != NULL)
+		PROF_MALLOC(bp, size);
+	TRACE(MMT_MALLOC, size, bp, GET_INDEX(asize), fit_search);
+	if (check_window > 0)
+		check_step();
+	HEAP_UNLOCK();
 	return (bp);
 } 
 
@@ -239,19 +662,70 @@ mm_malloc(size_t size)
 void
 mm_free(void *bp)
 {
-	size_t size;
 
 	/* Ignore spurious requests. */
 	if (bp == NULL)
 		return;
 
+#ifdef MM_THREADS
+	/*
+	 * Small blocks go to a quick bin without the lock if possible, and
+	 * while the maintenance thread runs, other blocks go to it.
+	 */
+	if (!GET_MOVABLE(HDRP(bp)) &&
+	    !atomic_load_explicit(&quick_off, memory_order_relaxed)) {
+		if (GET_SIZE(HDRP(bp)) <= QUICK_MAX && quick_push(bp)) {
+			COUNT(quick_frees);
+			TALLY(my_frees, GET_SIZE(HDRP(bp)));
+			TRACE(MMT_FREE, GET_SIZE(HDRP(bp)), bp,
+			    GET_INDEX(GET_SIZE(HDRP(bp))), 0);
+			return;
+		}
+		if (atomic_load_explicit(&maint_on, memory_order_relaxed)) {
+			defer_push(bp);
+			COUNT(deferred_frees);
+			TRACE(MMT_FREE, GET_SIZE(HDRP(bp)), bp,
+			    GET_INDEX(GET_SIZE(HDRP(bp))), 0);
+			return;
+		}
+	}
+#endif
+	HEAP_LOCK();
+	FOLD_COUNTS();
+	free_block(bp);
+	HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block.  The heap lock is held.
+ *
+ * Effects:
+ *   Free and coalesce the block "bp".
+ */
+static void
+free_block(void *bp)
+{
+	size_t size;
+	uintptr_t region;
+
+	/* Now and then, give long-unused large free blocks back to the OS. */
+	if (++op_clock == next_purge)
+		purge_free();
+
 	/* Free and coalesce the block. */
+	PROF_FREE(bp);
 	size = GET_SIZE(HDRP(bp));
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
-	//place_in_free_list(bp);
+	region = GET_REGION(HDRP(bp));
+	freed_since_compact += size;
+	class_frees[GET_INDEX(size)]++;
+	all_frees++;
+	PUT(HDRP(bp), PACK(size, region));
+	PUT(FTRP(bp), PACK(size, region));
+	TRACE(MMT_FREE, size, bp, GET_INDEX(size), 0);
 	coalesce(bp);
-
+	if (check_window > 0)
+		check_step();
 }
 
 /*
@@ -270,9 +744,10 @@ mm_free(void *bp)
 void *
 mm_realloc(void *ptr, size_t size)
 {
-    
-	size_t oldsize;
-	void *newptr;
+	size_t asize;      /* Adjusted block size */
+	size_t oldsize, psize, nsize;
+	uintptr_t region;
+	void *newptr, *prev, *next;
 
 	/* If size == 0 then this is just free, and we return NULL. */
 	if (size == 0) {
@@ -284,190 +759,697 @@ mm_realloc(void *ptr, size_t size)
 	if (ptr == NULL)
 		return (mm_malloc(size));
 
-//	newptr = mm_malloc(size);
-//
-//	/* If realloc() fails the original block is left untouched  */
-//	if (newptr == NULL)
-//		return (NULL);
+	/* Adjust block size to include overhead and alignment reqs. */
+	if (size <= DSIZE)
+		asize = 2 * DSIZE;
+	else
+		asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
 
-	/* Copy the old data. */
+	/* The block may already be big enough. */
 	oldsize = GET_SIZE(HDRP(ptr));
-	if (size <= oldsize) {
-		return ptr;
+	region = GET_REGION(HDRP(ptr));
+	if (asize <= oldsize) {
+		TRACE(MMT_REALLOC, size, ptr, GET_INDEX(oldsize), 0);
+		return (ptr);
 	}
-	printf("Realloc happening with size %d and oldsize %d \n", (int) size, (int) oldsize);
-	
-
-//	memcpy(newptr, ptr, oldsize);
-	//memmove(newptr, ptr, oldsize);
-		
-		//oldsize = size;
-	//check whether free block to the left is large enough
-	printf("This is inside the realloc function \n");
-	void *prev = PREV_BLKP(ptr);
-	void *next = NEXT_BLKP(ptr);
-	if ((!GET_ALLOC(FTRP(prev))) && ((GET_SIZE(HDRP(prev)) + oldsize) > size)) {
-		printf("case 1 realloc\n");
-//		printf("The size of free prev and allocated current blocks together is %d\n", (int) (GET_SIZE(HDRP(PREV_BLKP(ptr))) + oldsize));
-	    remove_from_free_list(prev);
-	    //PUT(HDRP(ptr), PACK(oldsize, 0));
-    	PUT(FTRP(ptr), PACK((GET_SIZE(HDRP(prev)) + oldsize), 1));
-    	PUT(HDRP(prev), PACK((GET_SIZE(HDRP(prev)) + oldsize), 1));
-    	memmove(prev, ptr, oldsize);
-    	printf("after memmove: This is the prev pointer %p and the current pointer %p\n", prev, ptr );
-    	printf("successful realloc completed\n");
-    	//ptr = PREV_BLKP(ptr);
-		return prev;
-		//return ptr;
-	}
-	//check whether free block to the right is large enough
-	if ((!GET_ALLOC(HDRP(next))) && ((GET_SIZE(HDRP(next)) + oldsize) > size)) {
-		printf("case 2 realloc\n");
+	HEAP_LOCK();
+
+	/*
+	 * Otherwise, try to grow it into free neighbors of either region.  The
+	 * grown block stays in its own region.
+	 */
+	prev = PREV_BLKP(ptr);
+	next = NEXT_BLKP(ptr);
+	psize = !GET_ALLOC(FTRP(prev)) ? GET_SIZE(FTRP(prev)) : 0;
+	nsize = !GET_ALLOC(HDRP(next)) ? GET_SIZE(HDRP(next)) : 0;
+	if (oldsize + nsize >= asize) {
+		/* Grow to the right; the payload stays put. */
+		PROF_FREE(ptr);
+		CHECK_ABSORB(next, ptr);
 		remove_from_free_list(next);
-    	PUT(HDRP(ptr), PACK((GET_SIZE(HDRP(next)) + oldsize), 1));
-    	PUT(FTRP(next), PACK((GET_SIZE(HDRP(next)) + oldsize), 1));
-//    	void *next = NEXT_BLKP(ptr);
-    	printf("before memmove: This is the next pointer %p and the current pointer %p\n", next, ptr );
-    	//memmove(next, ptr, oldsize);
-    	printf("after memmove: This is the next pointer %p and the current pointer %p\n", next, ptr );
-    	printf("successful realloc completed\n");
-
-    	//place(NEXT_BLKP(ptr), size);
-		//return NEXT_BLKP(ptr);
-		return ptr;
-	}
-	if ((!GET_ALLOC(FTRP(next))) &&
-	(!GET_ALLOC(HDRP(prev))) &&
-	((GET_SIZE(HDRP(next)) + GET_SIZE(HDRP(prev)) + oldsize) > size)) {
-			printf("case 3 realloc\n");
+		newptr = ptr;
+		PUT(HDRP(newptr), PACK(oldsize + nsize, region | 1));
+		PUT(FTRP(newptr), PACK(oldsize + nsize, region | 1));
+		PROF_MALLOC(newptr, size);
+	} else if (psize > 0 && psize + oldsize + nsize >= asize) {
+		/* Grow to the left, and to the right too if need be. */
+		PROF_FREE(ptr);
+		if (psize + oldsize < asize) {
+			CHECK_ABSORB(next, prev);
 			remove_from_free_list(next);
-    		remove_from_free_list(prev);
-    		PUT(HDRP(prev), PACK(GET_SIZE(HDRP(next)) + (GET_SIZE(HDRP(prev)) + oldsize), 1));
-    		PUT(FTRP(next), PACK(GET_SIZE(HDRP(next)) + (GET_SIZE(HDRP(prev)) + oldsize), 1));
-//    		void *prev = PREV_BLKP(ptr);
-    		memmove(prev, ptr, oldsize);
-    		//place(PREV_BLKP(ptr), size);
-	    	printf("after memmove: This is the prev pointer %p and the current pointer %p\n", prev, ptr );
-        	printf("successful realloc completed\n");
-    		return prev;
-    		//return PREV_BLKP(ptr);
+		} else
+			nsize = 0;
+		CHECK_ABSORB(ptr, prev);
+		remove_from_free_list(prev);
+		newptr = prev;
+		PUT(HDRP(newptr), PACK(psize + oldsize + nsize, region | 1));
+		PUT(FTRP(newptr), PACK(psize + oldsize + nsize, region | 1));
+		memmove(newptr, ptr, oldsize - DSIZE);
+		PROF_MALLOC(newptr, size);
+	} else {
+		/* No room in place; move the block within its region. */
+		newptr = mm_malloc_hint(size,
+		    region ? MM_LONG_LIVED : MM_SHORT_LIVED);
+
+		/* If realloc() fails the original block is left untouched  */
+		if (newptr == NULL) {
+			HEAP_UNLOCK();
+			return (NULL);
+		}
+		memcpy(newptr, ptr, oldsize - DSIZE);
+		mm_free(ptr);
 	}
-	printf("realloc failed, going on to malloc");
-	newptr = mm_malloc(size);
-	memcpy(newptr, ptr, oldsize);
-	mm_free(ptr);
+	TRACE(MMT_REALLOC, size, newptr, GET_INDEX(GET_SIZE(HDRP(newptr))), 0);
+	if (check_window > 0)
+		check_step();
+	HEAP_UNLOCK();
+	return (newptr);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a movable block with at least "size" bytes of payload, unless
+ *   "size" is zero.  Returns a handle to the block if the allocation was
+ *   successful and 0 otherwise.  The block's address must be obtained
+ *   through mm_hderef and is only valid until the next call to mm_malloc,
+ *   mm_realloc, mm_halloc, or mm_compact.
+ */
+mm_handle_t
+mm_halloc(size_t size)
+{
+	void **table;
+	void *ptr;
+	size_t h, nslots;
 
+	/* Ignore spurious requests. */
+	if (size == 0)
+		return (0);
 
-	/* Free the old block. */
-//	mm_free(ptr);
+	HEAP_LOCK();
 
-//	printf("finished realloc");
+	/* Double the handle table if every slot is in use. */
+	if (free_slot == 0) {
+		nslots = (handle_slots == 0) ? HSLOTS : 2 * handle_slots;
+		if ((table = movable_malloc(nslots * sizeof(void *), 0)) ==
+		    NULL) {
+			HEAP_UNLOCK();
+			return (0);
+		}
+		if (handle_table != NULL) {
+			memcpy(table, handle_table,
+			    handle_slots * sizeof(void *));
+			movable_free(handle_table);
+		}
+		handle_table = table;
+		free_slot = MAX(handle_slots, 1);
+		for (h = free_slot; h < nslots - 1; h++)
+			handle_table[h] = (void *)(h + 1);
+		handle_table[nslots - 1] = (void *)0;
+		handle_slots = nslots;
+	}
 
-	return (newptr);
+	/* The slot is only claimed once the block exists. */
+	h = free_slot;
+	if ((ptr = movable_malloc(size, h)) == NULL) {
+		HEAP_UNLOCK();
+		return (0);
+	}
+	free_slot = (size_t)handle_table[h];
+	handle_table[h] = ptr;
+	HEAP_UNLOCK();
+	return (h);
 }
 
 /*
- * The following routines are internal helper routines.
+ * Requires:
+ *   "h" is a handle returned by mm_halloc that has not been freed.
+ *
+ * Effects:
+ *   Returns the current address of the payload of the block "h".
  */
+void *
+mm_hderef(mm_handle_t h)
+{
+
+	return (handle_table[h]);
+}
 
 /*
  * Requires:
- *   "bp" is the address of a newly freed block.
+ *   "h" is either a handle returned by mm_halloc that has not been freed
+ *   or 0.
  *
  * Effects:
- *   Perform boundary tag coalescing.  Returns the address of the coalesced
- *   block.
+ *   Free the block "h" and its handle.
  */
-static void *
-coalesce(void *bp) 
+void
+mm_hfree(mm_handle_t h)
 {
-	printf("in coalesce\n");
-	size_t size = GET_SIZE(HDRP(bp));
-	bool prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-	//printf("\nThis is the initial size of the new block in coalesce %d \n", bp);
-
-	if (prev_alloc && next_alloc) {                 /* Case 1 - no coalescing*/
-//		printf("\n1: This is the new size of pointer in coalesce %d\n", (int) GET_SIZE(HDRP(bp)));
-		place_in_free_list((bp));
 
-		return (bp);
-	} else if (prev_alloc && !next_alloc) {         /* Case 2 - coalesce with next block (on right) */
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		remove_from_free_list(NEXT_BLKP(bp));
-		//should we leave this as it was here or keep the change to move it down??
-		//place_in_free_list(bp);
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-//		printf("\n2: This is the new size of pointer in coalesce %d\n", (int) GET_SIZE(HDRP(bp)));
-		place_in_free_list((bp));
-	
+	/* Ignore spurious requests. */
+	if (h == 0)
+		return;
 
-	} else if (!prev_alloc && next_alloc) {         /* Case 3 - coalesce with previous block (on left) */
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-		remove_from_free_list(PREV_BLKP(bp));
-		PUT(FTRP(bp), PACK(size, 0));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		bp = PREV_BLKP(bp);
-//		printf("\n3: This is the new size of pointer in coalesce %d\n", (int) GET_SIZE(HDRP(bp)));
-		place_in_free_list((bp));
-	} else {                                        /* Case 4 - coalesce with both prev and next blocks */
-		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
-		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
-		remove_from_free_list(NEXT_BLKP(bp));
-		remove_from_free_list(PREV_BLKP(bp));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-		bp = PREV_BLKP(bp);
-//		printf("\n4: This is the new size of pointer in coalesce %d\n", (int) GET_SIZE(HDRP(bp)));
-		place_in_free_list((bp));
-	}
-	return (bp);
+	HEAP_LOCK();
+	movable_free(handle_table[h]);
+	handle_table[h] = (void *)free_slot;
+	free_slot = h;
+	HEAP_UNLOCK();
 }
 
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   If "enable" is nonzero, start the payload of every later allocation of
+ *   a huge page or more on a huge page boundary, so that it can be backed
+ *   by whole transparent huge pages.  Otherwise, stop doing so.
+ */
+void
+mm_set_hugepage_align(int enable)
+{
 
+	huge_align = (enable != 0);
+}
 
-
-/* 
+/*
  * Requires:
  *   None.
  *
  * Effects:
- *   Extend the heap with a free block and return that block's address.
+ *   Keep the heap within "bytes" bytes, or remove the limit if "bytes" is
+ *   0.  An allocation that does not fit first frees cached blocks and
+ *   compacts, then calls "cb", if it is not NULL, with the size of the
+ *   block it needs.  If the heap is already over the new budget, trim
+ *   what can be trimmed now.
  */
-static void *
-extend_heap(size_t words) 
+void
+mm_set_budget(size_t bytes, mm_pressure_fn cb)
 {
-	size_t size;
-//	printf("\nThis is the number of words of sz 8 passed into extend_heap %d\n", (int) words);
 
-	void *bp;
+	HEAP_LOCK();
+	budget = bytes;
+	pressure_cb = cb;
+	if (budget > 0 && mem_heapsize() > budget) {
+#ifdef MM_THREADS
+		flush_parked();
+#endif
+		compact_heap(true);
+	}
+	HEAP_UNLOCK();
+}
 
-	/* Allocate an even number of words to maintain alignment. */
-	//do we need to make changes to our freeList here?? are multiple blocks created here?
-	//Check whether 2 needs to be 4
-	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-	if ((bp = mem_sbrk(size)) == (void *)-1)  
-		return (NULL);
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Slide every movable block toward the start of the heap, merging the
+ *   free space it leaves behind, and return any free block at the end of
+ *   the heap to the memory system.  Returns the number of bytes returned.
+ */
+size_t
+mm_compact(void)
+{
+	size_t trimmed;
+
+	HEAP_LOCK();
+#ifdef MM_THREADS
+	/* Parked blocks would pin the space around them. */
+	flush_parked();
+#endif
+	trimmed = compact_heap(true);
+	HEAP_UNLOCK();
+	return (trimmed);
+}
 
-	/* Initialize free block header/footer and the epilogue header. */
-	PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
-	PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
-	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Sample about one allocation per "interval" bytes allocated for the
+ *   heap profile, or stop sampling if "interval" is 0.
+ */
+void
+mm_prof_set_interval(size_t interval)
+{
 
-	return (coalesce(bp));
+	HEAP_LOCK();
+	mmprof_set_interval(interval);
+#ifdef MM_THREADS
+	/*
+	 * Sampled blocks must be freed under the lock, so if any are still
+	 * live the quick bins stay off until the next mm_init.
+	 */
+	prof_interval = interval;
+	if (interval != 0)
+		atomic_store(&quick_off, true);
+	else if (mmprof_live == 0)
+		atomic_store(&quick_off, false);
+#endif
+	HEAP_UNLOCK();
 }
 
+/*
+ * Requires:
+ *   "flags" is 0 or a combination of MM_PROF_FOLDED and MM_PROF_CUMULATIVE.
+ *
+ * Effects:
+ *   Write the heap profile to the file "path".  Returns 0 if the profile
+ *   was written and -1 otherwise.
+ */
+int
+mm_prof_dump(const char *path, int flags)
+{
+	int result;
 
+	HEAP_LOCK();
+	result = mmprof_dump(path, flags);
+	HEAP_UNLOCK();
+	return (result);
+}
 
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check "window" blocks of the heap, and one free list head, after
+ *   every later mm_malloc, mm_free, and mm_realloc, cycling through the
+ *   heap.  Problems found are printed and counted in the statistics.  A
+ *   window of 0 turns the checking off.
+ */
+void
+mm_set_check(int window)
+{
 
+	HEAP_LOCK();
+	check_window = MAX(window, 0);
+	HEAP_UNLOCK();
+}
 
 /*
-* Requires: pointer to free memory block
-*
-* Effects: Place block in appropriate location in freeList;
-*/
-static void 
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check the whole heap for consistency, printing every block if
+ *   "verbose" is nonzero.  Prints each problem found, counts it in the
+ *   statistics, and returns the number found.
+ */
+int
+mm_checkheap(int verbose)
+{
+	int errors;
+
+	HEAP_LOCK();
+	errors = checkheap(verbose != 0);
+	stats.check_errors += errors;
+	HEAP_UNLOCK();
+	return (errors);
+}
+
+/*
+ * Requires:
+ *   "st" is the address of a struct mm_stats.
+ *
+ * Effects:
+ *   Fill in "st" with the counts since mm_init and the current make-up of
+ *   the heap.  Finding the largest free block scans the highest nonempty
+ *   bin.
+ */
+void
+mm_get_stats(struct mm_stats *st)
+{
+	struct freeBlock *dummy_head, *current;
+	size_t total = 0;
+	int index, region;
+
+	HEAP_LOCK();
+	*st = stats;
+#ifdef MM_THREADS
+	for (index = 0; index < NCOUNTS; index++) {
+		st->quick_hits += atomic_load(&thread_counts[index].quick_hits);
+		st->quick_frees +=
+		    atomic_load(&thread_counts[index].quick_frees);
+		st->deferred_frees +=
+		    atomic_load(&thread_counts[index].deferred_frees);
+	}
+#endif
+	for (index = 0; index < free_list_size; index++)
+		total += st->free_bytes[index];
+	for (index = free_list_size - 1; index >= 0 && st->largest_free == 0;
+	    index--) {
+		for (region = 0; region < 2; region++) {
+			dummy_head = REGION_HEAD(region, index);
+			for (current = dummy_head->next; current != dummy_head;
+			    current = current->next)
+				st->largest_free = MAX(st->largest_free,
+				    GET_SIZE(HDRP(current)));
+		}
+	}
+	st->frag = (total > 0) ? 1.0 - (double)st->largest_free / total : 0.0;
+	st->heap_bytes = mem_heapsize();
+
+	/*
+	 * The rest of the heap is the heads, prologue, and epilogue.  Blocks
+	 * parked in quick bins or the deferred queue count as live.
+	 */
+	st->live_bytes = st->heap_bytes - total - 4 * WSIZE -
+	    free_list_size * sizeof(struct freeHead);
+	if (long_heads != unmade_heads)
+		st->live_bytes -= GET_SIZE(HDRP(long_heads));
+	HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   "period_ms" is positive.
+ *
+ * Effects:
+ *   Start the maintenance thread, which frees deferred blocks every
+ *   "period_ms" milliseconds and tidies the heap when the allocator is
+ *   idle.  Returns 0 if the thread was started and -1 if it was already
+ *   running, could not be created, or the allocator is not threaded.
+ */
+int
+mm_start_maintenance(unsigned int period_ms)
+{
+#ifdef MM_THREADS
+
+	if (period_ms == 0 || atomic_load(&maint_on))
+		return (-1);
+	maint_period = period_ms;
+	atomic_store(&maint_kicked, false);
+	atomic_store(&maint_on, true);
+	if (pthread_create(&maint_thread, NULL, maint_main, NULL) != 0) {
+		atomic_store(&maint_on, false);
+		return (-1);
+	}
+	return (0);
+#else
+
+	(void)period_ms;
+	return (-1);
+#endif
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Stop the maintenance thread, if it is running, and free the blocks it
+ *   left behind.
+ */
+void
+mm_stop_maintenance(void)
+{
+#ifdef MM_THREADS
+
+	if (!atomic_load(&maint_on))
+		return;
+	pthread_mutex_lock(&maint_lock);
+	atomic_store(&maint_on, false);
+	pthread_cond_signal(&maint_wake);
+	pthread_mutex_unlock(&maint_lock);
+	pthread_join(maint_thread, NULL);
+	HEAP_LOCK();
+	drain_deferred();
+	HEAP_UNLOCK();
+#endif
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly freed block.
+ *
+ * Effects:
+ *   Perform boundary tag coalescing.  Returns the address of the coalesced
+ *   block.
+ */
+static void *
+coalesce(void *bp) 
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	uintptr_t region = GET_REGION(HDRP(bp));
+	bool prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+	size_t largest = size;
+
+	/*
+	 * Free neighbors merge whatever their region; the merged block takes
+	 * the region of its largest piece.
+	 */
+	if (!prev_alloc && GET_SIZE(FTRP(PREV_BLKP(bp))) > largest) {
+		largest = GET_SIZE(FTRP(PREV_BLKP(bp)));
+		region = GET_REGION(FTRP(PREV_BLKP(bp)));
+	}
+	if (!next_alloc && GET_SIZE(HDRP(NEXT_BLKP(bp))) > largest)
+		region = GET_REGION(HDRP(NEXT_BLKP(bp)));
+	//printf("\nThis is the initial size of the new block in coalesce %d \n", bp);
+
+	if (prev_alloc && next_alloc) {                 /* Case 1 - no coalescing*/
+		place_in_free_list((bp));
+		stats.coalesces[0]++;
+		TRACE(MMT_COALESCE, size, bp, GET_INDEX(size), 1);
+		return (bp);
+	} else if (prev_alloc && !next_alloc) {         /* Case 2 - coalesce with next block (on right) */
+		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+		CHECK_ABSORB(NEXT_BLKP(bp), bp);
+		remove_from_free_list(NEXT_BLKP(bp));
+		//should we leave this as it was here or keep the change to move it down??
+		//place_in_free_list(bp);
+		PUT(HDRP(bp), PACK(size, region));
+		PUT(FTRP(bp), PACK(size, region));
+		place_in_free_list((bp));
+		stats.coalesces[1]++;
+		TRACE(MMT_COALESCE, size, bp, GET_INDEX(size), 2);
+
+	} else if (!prev_alloc && next_alloc) {         /* Case 3 - coalesce with previous block (on left) */
+		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+		CHECK_ABSORB(bp, PREV_BLKP(bp));
+		remove_from_free_list(PREV_BLKP(bp));
+		PUT(FTRP(bp), PACK(size, region));
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, region));
+		bp = PREV_BLKP(bp);
+		place_in_free_list((bp));
+		stats.coalesces[2]++;
+		TRACE(MMT_COALESCE, size, bp, GET_INDEX(size), 3);
+	} else {                                        /* Case 4 - coalesce with both prev and next blocks */
+		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
+		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
+		CHECK_ABSORB(bp, PREV_BLKP(bp));
+		CHECK_ABSORB(NEXT_BLKP(bp), PREV_BLKP(bp));
+		remove_from_free_list(NEXT_BLKP(bp));
+		remove_from_free_list(PREV_BLKP(bp));
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, region));
+		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, region));
+		bp = PREV_BLKP(bp);
+		place_in_free_list((bp));
+		stats.coalesces[3]++;
+		TRACE(MMT_COALESCE, size, bp, GET_INDEX(size), 4);
+	}
+	return (bp);
+}
+
+
+
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Walk the heap in address order, swapping each free block with the
+ *   movable block that follows it so that free space drifts toward the
+ *   end of the heap and merges along the way.  Pinned blocks stop the
+ *   drift.  If "trim" is true, release a trailing free block through
+ *   mem_sbrk.  Returns the number of bytes released.
+ */
+static size_t
+compact_heap(bool trim)
+{
+	void *bp, *next;
+	size_t fsize, msize;
+	uintptr_t region;
+
+	freed_since_compact = 0;
+	check_cursor = NULL;
+	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		if (GET_ALLOC(HDRP(bp)))
+			continue;
+		region = GET_REGION(HDRP(bp));
+		while (GET_MOVABLE(HDRP(next = NEXT_BLKP(bp)))) {
+			/* Move the whole movable block, tags included, down. */
+			fsize = GET_SIZE(HDRP(bp));
+			msize = GET_SIZE(HDRP(next));
+			remove_from_free_list(bp);
+			memmove(HDRP(bp), HDRP(next), msize);
+			PROF_MOVE(next, bp);
+			if (GET(bp) == 0)
+				handle_table = (void **)((char *)bp + WSIZE);
+			else
+				handle_table[GET(bp)] = (char *)bp + WSIZE;
+
+			/*
+			 * The free space now follows it; merge with a free
+			 * successor of either region, as coalesce does.
+			 */
+			bp = NEXT_BLKP(bp);
+			next = (char *)bp + fsize;
+			if (!GET_ALLOC(HDRP(next))) {
+				remove_from_free_list(next);
+				if (GET_SIZE(HDRP(next)) > fsize)
+					region = GET_REGION(HDRP(next));
+				fsize += GET_SIZE(HDRP(next));
+			}
+			PUT(HDRP(bp), PACK(fsize, region));
+			PUT(FTRP(bp), PACK(fsize, region));
+			place_in_free_list(bp);
+		}
+	}
+
+	/* "bp" is now the epilogue; trim the block in front of it if free. */
+	if (!trim || (fsize = trim_heap(0)) == 0) {
+		TRACE(MMT_COMPACT, 0, bp, -1, 0);
+		return (0);
+	}
+	return (fsize);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   If the last block of the heap is free and at least "min" bytes,
+ *   return it to the memory system.  Returns the number of bytes
+ *   returned.
+ */
+static size_t
+trim_heap(size_t min)
+{
+	void *bp = PREV_BLKP((char *)mem_heap_hi() + 1);
+	size_t fsize = GET_SIZE(HDRP(bp));
+
+	if (GET_ALLOC(HDRP(bp)) || fsize < min)
+		return (0);
+	CHECK_ABSORB(bp, NULL);
+	remove_from_free_list(bp);
+	if (mem_sbrk(-(intptr_t)fsize) == (void *)-1) {
+		place_in_free_list(bp);
+		return (0);
+	}
+	PUT(HDRP(bp), PACK(0, 1));            /* New epilogue header */
+	stats.trim_bytes += fsize;
+	TRACE(MMT_COMPACT, fsize, bp, -1, 0);
+	return (fsize);
+}
+
+/*
+ * Requires:
+ *   "owner" is the handle that will name the block, or 0 if the block will
+ *   be the handle table.
+ *
+ * Effects:
+ *   Allocate a movable block with at least "size" bytes of payload after
+ *   its owner word.  Returns the address of that payload if the allocation
+ *   was successful and NULL otherwise.
+ */
+static void *
+movable_malloc(size_t size, size_t owner)
+{
+	void *bp;
+
+	if ((bp = mm_malloc(size + WSIZE)) == NULL)
+		return (NULL);
+	PUT(HDRP(bp), GET(HDRP(bp)) | MOVABLE);
+	PUT(FTRP(bp), GET(FTRP(bp)) | MOVABLE);
+	PUT(bp, owner);
+	handle_bytes += GET_SIZE(HDRP(bp));
+	return ((char *)bp + WSIZE);
+}
+
+/*
+ * Requires:
+ *   "ptr" is a payload address returned by movable_malloc.
+ *
+ * Effects:
+ *   Free the movable block whose payload is "ptr".
+ */
+static void
+movable_free(void *ptr)
+{
+	void *bp = (char *)ptr - WSIZE;
+
+	handle_bytes -= GET_SIZE(HDRP(bp));
+	mm_free(bp);
+}
+
+/* 
+ * Requires:
+ *   "region" is LONG_LIVED or 0.
+ *
+ * Effects:
+ *   Extend the heap with a free block in "region" and return that block's
+ *   address.
+ */
+static void *
+extend_heap(size_t words, uintptr_t region) 
+{
+	size_t size;
+//	printf("\nThis is the number of words of sz 8 passed into extend_heap %d\n", (int) words);
+
+	void *bp;
+
+	/* A free block at the end of the heap joins whichever region grows. */
+	bp = PREV_BLKP((char *)mem_heap_hi() + 1);
+	if (!GET_ALLOC(HDRP(bp)) && GET_REGION(HDRP(bp)) != region) {
+		size = GET_SIZE(HDRP(bp));
+		remove_from_free_list(bp);
+		PUT(HDRP(bp), PACK(size, region));
+		PUT(FTRP(bp), PACK(size, region));
+		place_in_free_list(bp);
+	}
+
+	/* Allocate an even number of words to maintain alignment. */
+	//do we need to make changes to our freeList here?? are multiple blocks created here?
+	//Check whether 2 needs to be 4
+	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+	if ((bp = mem_sbrk(size)) == (void *)-1)  
+		return (NULL);
+	stats.extends++;
+	stats.sbrk_bytes += size;
+
+	/* Initialize free block header/footer and the epilogue header. */
+	PUT(HDRP(bp), PACK(size, region));    /* Free block header */
+	PUT(FTRP(bp), PACK(size, region));    /* Free block footer */
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+	TRACE(MMT_EXTEND, size, bp, -1, 0);
+
+	return (coalesce(bp));
+}
+
+
+
+
+
+/*
+* Requires: pointer to free memory block
+*
+* Effects: Place block in appropriate location in freeList;
+*/
+static void 
 place_in_free_list(void* bp) {
 
 //    printf("Starting place in free list\n");
@@ -478,11 +1460,19 @@ place_in_free_list(void* bp) {
 	int index = GET_INDEX(block_size);
 	struct freeBlock *new_block = bp;
 
-	dummy_head = &array_heads[index];
+	dummy_head = REGION_HEAD(GET_REGION(HDRP(bp)), index);
+	TOUCH_HEAD(dummy_head);
+	TOUCH_NODE(dummy_head->next);
+	TOUCH_NODE(new_block);
 	new_block->prev = dummy_head;
 	new_block->next = dummy_head->next;
 	dummy_head->next->prev = new_block;
 	dummy_head->next = new_block;
+	if (index != MIN_INDEX)
+		new_block->size = block_size;
+	stats.free_bytes[index] += block_size;
+	if (block_size >= PURGE_MIN)
+		STAMP(bp) = op_clock;
 
 //	printf("Finished placing into free list with size: %d and next address is: %p\n", (int)block_size, new_block);
 
@@ -499,8 +1489,18 @@ remove_from_free_list(void* bp) {
 //    printf("starting remove from free list\n");
 
 	struct freeBlock *current = bp;
+	size_t block_size = GET_SIZE(HDRP(bp));
+
+	TOUCH_NODE(current);
+	TOUCH_NODE(current->prev);
+	TOUCH_NODE(current->next);
+	if (block_size >= PURGE_MIN && PURGE_EDGE(GET_REGION(HDRP(bp)),
+	    GET_INDEX(block_size)) == current)
+		PURGE_EDGE(GET_REGION(HDRP(bp)), GET_INDEX(block_size)) =
+		    current->next;
 	current->prev->next = current->next;
     current->next->prev = current->prev;	
+	stats.free_bytes[GET_INDEX(block_size)] -= block_size;
 
 
 	/*int block_size = GET_SIZE(HDRP(bp));
@@ -521,41 +1521,52 @@ remove_from_free_list(void* bp) {
 
 /*
  * Requires:
- *   None.
+ *   "region" is LONG_LIVED or 0.
  * Effects:
- *   Find a fit for a block with "asize" bytes.  Returns that block's address
- *   or NULL if no suitable block was found. 
+ *   Find a fit for a block with "asize" bytes in "region".  Returns that
+ *   block's address or NULL if no suitable block was found. 
  */
 static void *
-find_fit(size_t asize)
+find_fit(size_t asize, uintptr_t region)
 {
 //    printf("Starting found fit func on size: %d\n", (int) asize);
 //    print_free_list();
 
-	struct freeBlock *current;
+	struct freeBlock *current, *next;
 	int first_index = GET_INDEX(asize);
-	//printf("The index we are starting at is: %d\n", first_index);
 	struct freeBlock *dummy_head;
-//	void *new_mem_location;
+
+	fit_search = 0;
 
 	/* find appropriate size range beginning at smallest possible fit, repopulate size range if neccesary*/
 	for (int index = first_index ; index < free_list_size; index++) {
-        dummy_head = &array_heads[index];
-        current = dummy_head->next;
-		/* if memory is available in size range iterate to find block large enough*/
-		while(current != dummy_head) {
-		    //WANTED TO TRY GET_SIZE(HDRP(current)), but that didn't work
-			if (GET_SIZE(HDRP(current)) >= asize){
-//			    printf("found fit! of size: %d\n", (int) GET_SIZE(HDRP(current)));
+        dummy_head = REGION_HEAD(region, index);
+		TOUCH_HEAD(dummy_head);
+		/*
+		 * Only the first bin can hold blocks that are too small, and
+		 * only if it holds more than one size.  Fetch the node after
+		 * next while this one is checked.
+		 */
+		for (current = dummy_head->next; current != dummy_head;
+		    current = next) {
+			TOUCH_NODE(current);
+			next = current->next;
+			__builtin_prefetch(next->next);
+			fit_search++;
+			if (index > first_index || index == MIN_INDEX ||
+			    current->size >= asize) {
+				stats.fit_hits[index]++;
+				fit_bins = index - first_index + 1;
+				count_fit(asize);
 				return current;
 			}
-			current = current->next;
 		}
 
 	}
 
-//	printf("could not find fit, need to extend heap\n");
-
+	stats.fit_misses++;
+	fit_bins = free_list_size - first_index;
+	count_fit(asize);
 	return NULL;
 
 
@@ -570,6 +1581,92 @@ find_fit(size_t asize)
 
 
 
+}
+
+/*
+ * Requires:
+ *   "asize" is an adjusted block size.  "region" is LONG_LIVED or 0.
+ *
+ * Effects:
+ *   Find a free block of at least "asize" bytes in the region other than
+ *   "region", visiting at most STEAL_SCAN free list nodes.  Returns the
+ *   address of the block, or NULL if none was found.
+ */
+static void *
+steal_fit(size_t asize, uintptr_t region)
+{
+	struct freeBlock *dummy_head, *current;
+	int budget = STEAL_SCAN;
+	int first_index = GET_INDEX(asize);
+	int index;
+
+	for (index = first_index; index < free_list_size; index++) {
+		dummy_head = REGION_HEAD(region ^ LONG_LIVED, index);
+		TOUCH_HEAD(dummy_head);
+		for (current = dummy_head->next; current != dummy_head;
+		    current = current->next) {
+			TOUCH_NODE(current);
+			if (index > first_index || index == MIN_INDEX ||
+			    current->size >= asize)
+				return (current);
+			if (--budget == 0)
+				return (NULL);
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "asize" is an adjusted block size.  "region" is LONG_LIVED or 0.  No
+ *   free block fits, and growing the heap as usual would exceed the
+ *   budget.
+ *
+ * Effects:
+ *   Relieve memory pressure: free parked blocks and compact, then grow
+ *   the heap by only what the request still lacks if that stays within
+ *   the budget.  Otherwise, ask pressure_cb to free "asize" bytes and try
+ *   again.  Purging does not help, since the budget counts the heap's
+ *   size and not its resident pages.  Returns a free block of at least
+ *   "asize" bytes, from "region" if it has one and else from the other
+ *   region, or NULL if the request cannot be met within the budget.
+ */
+static void *
+budget_fit(size_t asize, uintptr_t region)
+{
+	size_t need, tail;
+	void *bp;
+	int tries;
+
+	stats.pressure_events++;
+	for (tries = 0; ; tries++) {
+#ifdef MM_THREADS
+		flush_parked();
+#endif
+		if (handle_bytes > 0)
+			compact_heap(false);
+
+		/* What pressure_cb freed may have gone to either region. */
+		if ((bp = find_fit(asize, region)) != NULL ||
+		    (bp = find_fit(asize, region ^ LONG_LIVED)) != NULL)
+			return (bp);
+
+		/*
+		 * A free block at the end of the heap, of either region, joins
+		 * the new space.  It is smaller than "asize", or find_fit
+		 * would have returned it.
+		 */
+		bp = PREV_BLKP((char *)mem_heap_hi() + 1);
+		tail = !GET_ALLOC(HDRP(bp)) ? GET_SIZE(HDRP(bp)) : 0;
+		need = asize - tail;
+		if (mem_heapsize() + need <= budget)
+			return (extend_heap(need / WSIZE, region));
+		if (pressure_cb == NULL || tries == PRESSURE_TRIES ||
+		    pressure_cb(asize) == 0)
+			break;
+	}
+	stats.budget_failures++;
+	return (NULL);
 }
 
 /* 
@@ -585,48 +1682,726 @@ static void
 place(void *bp, size_t asize)
 {
 	size_t csize = GET_SIZE(HDRP(bp));
+	uintptr_t region = GET_REGION(HDRP(bp));
 //	printf("We're about to PLACE, and the block we're placing into has size: %d\n", (int) csize);
 
 	if ((csize - asize) >= (4 * DSIZE)) {
 //	    printf("\nPLACE FUNC - fragmenting block\n");
 //	    print_free_list();
 	    remove_from_free_list(bp);
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
+		stats.splits++;
+		PUT(HDRP(bp), PACK(asize, region | 1));
+		PUT(FTRP(bp), PACK(asize, region | 1));
 		bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(csize - asize, 0));
-		PUT(FTRP(bp), PACK(csize - asize, 0));
+		PUT(HDRP(bp), PACK(csize - asize, region));
+		PUT(FTRP(bp), PACK(csize - asize, region));
 		place_in_free_list(bp);
 //		print_free_list();
 	} else {
 //	    printf("\nPLACE FUNC - not fragmenting block\n");
 //	    print_free_list();
 	    remove_from_free_list(bp);
-		PUT(HDRP(bp), PACK(csize, 1));
-		PUT(FTRP(bp), PACK(csize, 1));
+		PUT(HDRP(bp), PACK(csize, region | 1));
+		PUT(FTRP(bp), PACK(csize, region | 1));
 //		print_free_list();
 	}
 }
 
 /* 
- * The remaining routines are heap consistency checker routines. 
+ * Requires:
+ *   "asize" is an adjusted block size.  "region" is LONG_LIVED or 0.
+ *
+ * Effects:
+ *   Allocate a block of "asize" bytes in "region", growing the heap if no
+ *   free block fits.  Returns the address of the block if the allocation
+ *   was successful and NULL otherwise.
  */
+static void *
+alloc_block(size_t asize, uintptr_t region)
+{
+	size_t extendsize; /* Amount to extend heap if no fit */
+	void *bp;
+
+	/* Search the free list for a fit. */
+
+	if ((bp = find_fit(asize, region)) != NULL) {
+		place(bp, asize);
+//		printf("finished malloc-ing with a block of adjusted size: %d\n", (int) asize);
+//		print_free_list();
+//		printf("This is the block returned to be malloc-ed: %p\n", bp);
+		return (bp);
+	}
+
+	/*
+	 * No fit found.  If movable blocks exist and enough has been freed
+	 * since the last compaction to possibly satisfy the request, slide
+	 * them together before growing the heap.
+	 */
+	if (handle_bytes > 0 && freed_since_compact >= asize) {
+		compact_heap(false);
+		if ((bp = find_fit(asize, region)) != NULL) {
+			place(bp, asize);
+			return (bp);
+		}
+	}
+
+#ifdef MM_THREADS
+	/* Parked blocks may coalesce into a fit. */
+	if (flush_parked() > 0 && (bp = find_fit(asize, region)) != NULL) {
+		place(bp, asize);
+		return (bp);
+	}
+#endif
+
+	/*
+	 * Take a block from the other region.  It keeps that region's color,
+	 * so that a free remainder stays in the list it was found in.
+	 */
+	if (region == 0 && (bp = steal_fit(asize, region)) != NULL) {
+		place(bp, asize);
+		stats.steals++;
+		return (bp);
+	}
+
+	/* No fit found.  Get more memory and place the block. */
+	count_extend(asize);
+	extendsize = MAX(asize, CHUNKSIZE);
+	if (budget > 0 && mem_heapsize() + extendsize > budget)
+		bp = budget_fit(asize, region);
+	else
+		bp = extend_heap(extendsize / WSIZE, region);
+	if (bp == NULL)
+		return (NULL);
+	place(bp, asize);
+//	printf("finished malloc-ing a block of adjusted size: %d\n", (int) asize);
+//	print_free_list();
+//	printf("This is the block returned to be malloc-ed: %p\n", bp);
+
+	return (bp);
+}
 
 /*
  * Requires:
- *   "bp" is the address of a block.
+ *   The long-lived region's heads are not made yet.  The heap lock is
+ *   held.
  *
  * Effects:
- *   Perform a minimal check on the block "bp".
+ *   Allocate a block in the short-lived region for the long-lived
+ *   region's dummy heads and switch long_heads to it.  The block is never
+ *   freed.  Returns 0 if successful and -1 if there was no room.
+ */
+static int
+make_long_heads(void)
+{
+	struct freeHead *heads;
+	size_t asize;
+	int i;
+
+	asize = DSIZE * ((free_list_size * sizeof(struct freeHead) + DSIZE +
+	    (DSIZE - 1)) / DSIZE);
+	if ((heads = alloc_block(asize, 0)) == NULL)
+		return (-1);
+	long_heads = heads;
+	for (i = free_list_size; i < 2 * free_list_size; i++) {
+		HEAD(i)->prev = HEAD(i);
+		HEAD(i)->next = HEAD(i);
+		purge_edge[i] = HEAD(i);
+	}
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "asize" is an adjusted block size.  "region" is LONG_LIVED or 0.
+ *
+ * Effects:
+ *   Allocate a block of "asize" bytes in "region" whose payload starts on
+ *   a huge page boundary, returning any space in front of it to the free
+ *   list.  Returns the address of the block if the allocation was
+ *   successful and NULL otherwise.
+ */
+static void *
+huge_malloc(size_t asize, uintptr_t region)
+{
+	size_t hsize = mem_hugepagesize();
+	size_t fsize = asize + hsize + 2 * DSIZE; /* Fits any leading gap */
+	size_t csize, gap;
+	char *bp, *abp;
+
+	bp = find_fit(fsize, region);
+#ifdef MM_THREADS
+	if (bp == NULL && flush_parked() > 0)
+		bp = find_fit(fsize, region);
+#endif
+	if (bp == NULL) {
+		count_extend(fsize);
+		if (budget > 0 && mem_heapsize() + fsize > budget)
+			bp = budget_fit(fsize, region);
+		else
+			bp = extend_heap(fsize / WSIZE, region);
+		if (bp == NULL)
+			return (NULL);
+	}
+
+	/* The leading gap must be empty or big enough to be a free block. */
+	abp = (char *)(((uintptr_t)bp + hsize - 1) & ~(hsize - 1));
+	if (abp != bp && (size_t)(abp - bp) < 2 * DSIZE)
+		abp += hsize;
+	if ((gap = abp - bp) > 0) {
+		csize = GET_SIZE(HDRP(bp));
+		remove_from_free_list(bp);
+		PUT(HDRP(bp), PACK(gap, region));
+		PUT(FTRP(bp), PACK(gap, region));
+		place_in_free_list(bp);
+		PUT(HDRP(abp), PACK(csize - gap, region));
+		PUT(FTRP(abp), PACK(csize - gap, region));
+		place_in_free_list(abp);
+	}
+	place(abp, asize);
+	return (abp);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Purge the interior pages of free blocks that have been free for at
+ *   least PURGE_DECAY operations.  Each bin is walked from its oldest
+ *   resident block toward its head, stopping at the first block too young
+ *   to purge; a purged block stays where it is and becomes the bin's
+ *   PURGE_EDGE.  At most PURGE_SCAN blocks are examined.
+ */
+static void
+purge_free(void)
+{
+	struct freeBlock *dummy_head, *current;
+	int budget = PURGE_SCAN;
+	int index, region;
+	char *lo;
+
+	next_purge = op_clock + PURGE_PERIOD;
+	for (region = 0; region < 2; region++) {
+		for (index = GET_INDEX(PURGE_MIN); index < free_list_size;
+		    index++) {
+			dummy_head = REGION_HEAD(region, index);
+			TOUCH_HEAD(dummy_head);
+			for (current = PURGE_EDGE(region, index)->prev;
+			    current != dummy_head; current = current->prev) {
+				TOUCH_NODE(current);
+				if (budget-- == 0)
+					return;
+				if (op_clock - STAMP(current) < PURGE_DECAY)
+					break;
+				lo = (char *)&STAMP(current) + WSIZE;
+				mem_purge(lo, FTRP(current) - lo);
+				TRACE(MMT_PURGE, GET_SIZE(HDRP(current)), current,
+				    index, 0);
+				STAMP(current) = PURGED;
+				PURGE_EDGE(region, index) = current;
+			}
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Count an allocation of "asize" bytes and return the region that the
+ *   lifetimes seen so far suggest for it: LONG_LIVED if few blocks of its
+ *   size class have been freed relative to the number allocated, and 0
+ *   otherwise.
+ */
+static uintptr_t
+classify(size_t asize)
+{
+	int index = GET_INDEX(asize);
+
+	if (++class_allocs[index] >= LIFETIME_WINDOW) {
+		class_allocs[index] /= 2;
+		class_frees[index] /= 2;
+	}
+	if (++all_allocs >= LIFETIME_WINDOW) {
+		all_allocs /= 2;
+		all_frees /= 2;
+	}
+	if (class_allocs[index] >= LIFETIME_MIN &&
+	    class_frees[index] * LIFETIME_RATIO < class_allocs[index] &&
+	    all_frees * LIFETIME_RATIO >= all_allocs)
+		return (LONG_LIVED);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the log2 histogram bucket for "n", as described in mm.h.
+ */
+static inline int
+hist_bucket(unsigned int n)
+{
+	int bucket = (n == 0) ? 0 : 32 - __builtin_clz(n);
+
+	return (bucket < MM_HIST ? bucket : MM_HIST - 1);
+}
+
+/*
+ * Requires:
+ *   find_fit has just searched for a block of "asize" bytes.
+ *
+ * Effects:
+ *   Add the search to the search length histograms, and keep it if it is
+ *   among the MM_NSLOW longest so far.
  */
 static void
+count_fit(size_t asize)
+{
+	struct mm_slow_op *slow = stats.longest_fits;
+	int i;
+
+	stats.fit_nodes[hist_bucket(fit_search)]++;
+	stats.fit_bins[hist_bucket(fit_bins)]++;
+	if (fit_search <= slow[MM_NSLOW - 1].nodes)
+		return;
+	for (i = MM_NSLOW - 1; i > 0 && slow[i - 1].nodes < fit_search; i--)
+		slow[i] = slow[i - 1];
+	slow[i].op = op_clock;
+	slow[i].size = asize;
+	slow[i].nodes = fit_search;
+	slow[i].bins = fit_bins;
+}
+
+/*
+ * Requires:
+ *   The last find_fit call failed to find a block of "asize" bytes.
+ *
+ * Effects:
+ *   Count a request that is about to extend the heap, and keep it if it is
+ *   among the first MM_NSLOW.
+ */
+static void
+count_extend(size_t asize)
+{
+	struct mm_slow_op *slow = stats.first_extends;
+	int i;
+
+	stats.extend_bins[GET_INDEX(asize)]++;
+	for (i = 0; i < MM_NSLOW; i++) {
+		if (slow[i].size == 0) {
+			slow[i].op = op_clock;
+			slow[i].size = asize;
+			slow[i].nodes = fit_search;
+			slow[i].bins = fit_bins;
+			break;
+		}
+	}
+}
+
+#ifdef MM_THREADS
+/*
+ * Requires:
+ *   "asize" is an adjusted block size of at most QUICK_MAX.  "region" is
+ *   LONG_LIVED or 0.
+ *
+ * Effects:
+ *   Pop a block of exactly "asize" bytes in "region" from its quick bin,
+ *   without the heap lock.  Returns the address of the block, or NULL if
+ *   the bin is empty.
+ */
+static void *
+quick_pop(size_t asize, uintptr_t region)
+{
+	struct quick_bin *bin = &quick_bins[region ? 1 : 0][asize / DSIZE - 2];
+	uint64_t top, next;
+	char *bp;
+
+	top = atomic_load_explicit(&bin->top, memory_order_acquire);
+	do {
+		if (QUICK_OFF(top) == 0)
+			return (NULL);
+		bp = quick_base + QUICK_OFF(top) * DSIZE;
+		next = __atomic_load_n((uint64_t *)bp, __ATOMIC_RELAXED);
+	} while (!atomic_compare_exchange_weak_explicit(&bin->top, &top,
+	    QUICK_TOP(top, next), memory_order_acquire,
+	    memory_order_acquire));
+	atomic_fetch_sub_explicit(&bin->count, 1, memory_order_relaxed);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated, unmovable block of at most
+ *   QUICK_MAX bytes.
+ *
+ * Effects:
+ *   Push the block "bp" onto its quick bin, without the heap lock, leaving
+ *   it marked allocated.  Returns false, doing nothing, if the bin is
+ *   full or the block is too far into the heap for its offset to fit.
+ */
+static bool
+quick_push(void *bp)
+{
+	struct quick_bin *bin = &quick_bins[GET_REGION(HDRP(bp)) ? 1 : 0]
+	    [GET_SIZE(HDRP(bp)) / DSIZE - 2];
+	uint64_t top, off = ((char *)bp - quick_base) / DSIZE;
+
+	if ((uint64_t)((char *)bp - quick_base) > QUICK_SPAN)
+		return (false);
+	if (atomic_fetch_add_explicit(&bin->count, 1, memory_order_relaxed) >=
+	    QUICK_CAP) {
+		atomic_fetch_sub_explicit(&bin->count, 1,
+		    memory_order_relaxed);
+		return (false);
+	}
+	top = atomic_load_explicit(&bin->top, memory_order_relaxed);
+	do {
+		__atomic_store_n((uint64_t *)bp, QUICK_OFF(top),
+		    __ATOMIC_RELAXED);
+	} while (!atomic_compare_exchange_weak_explicit(&bin->top, &top,
+	    QUICK_TOP(top, off), memory_order_release, memory_order_relaxed));
+	return (true);
+}
+
+/*
+ * Requires:
+ *   The heap lock is held.
+ *
+ * Effects:
+ *   Add this thread's quick path tallies to the lifetime classifier's
+ *   counts, unless they were begun before the last mm_init, and clear
+ *   them.
+ */
+static void
+fold_counts(void)
+{
+	int i;
+
+	if (my_unfolded == 0)
+		return;
+	if (my_epoch == atomic_load_explicit(&class_epoch,
+	    memory_order_relaxed)) {
+		for (i = 0; i < NQCLASS; i++) {
+			class_allocs[i] += my_allocs[i];
+			class_frees[i] += my_frees[i];
+			all_allocs += my_allocs[i];
+			all_frees += my_frees[i];
+		}
+	}
+	memset(my_allocs, 0, sizeof(my_allocs));
+	memset(my_frees, 0, sizeof(my_frees));
+	my_unfolded = 0;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated, unmovable block.
+ *
+ * Effects:
+ *   Push the block "bp" onto the deferred queue, without the heap lock,
+ *   leaving it marked allocated.  Wakes the maintenance thread if enough
+ *   blocks are waiting and nobody has woken it since its last drain.  The
+ *   signal is sent under maint_lock, so it cannot slip in between the
+ *   thread's check of the queue and its wait.
+ */
+static void
+defer_push(void *bp)
+{
+	char *top = atomic_load_explicit(&deferred, memory_order_relaxed);
+
+	do {
+		*(char **)bp = top;
+	} while (!atomic_compare_exchange_weak_explicit(&deferred, &top,
+	    (char *)bp, memory_order_release, memory_order_relaxed));
+	if (atomic_fetch_add_explicit(&deferred_count, 1,
+	    memory_order_relaxed) + 1 >= DEFER_WAKE &&
+	    !atomic_exchange(&maint_kicked, true)) {
+		pthread_mutex_lock(&maint_lock);
+		pthread_cond_signal(&maint_wake);
+		pthread_mutex_unlock(&maint_lock);
+	}
+}
+
+/*
+ * Requires:
+ *   The heap lock is held.
+ *
+ * Effects:
+ *   Empty the deferred queue, freeing and coalescing its blocks.  Returns
+ *   the number of blocks freed.
+ */
+static size_t
+drain_deferred(void)
+{
+	char *bp, *next;
+	size_t n;
+
+	/* Coalescing overwrites the links, so read each one first. */
+	bp = atomic_exchange_explicit(&deferred, NULL, memory_order_acquire);
+	for (n = 0; bp != NULL; bp = next, n++) {
+		next = *(char **)bp;
+		free_block(bp);
+	}
+	atomic_fetch_sub_explicit(&deferred_count, n, memory_order_relaxed);
+	return (n);
+}
+
+/*
+ * Requires:
+ *   The heap lock is held.
+ *
+ * Effects:
+ *   Empty the deferred queue and every quick bin, freeing and coalescing
+ *   their blocks.  Returns the number of blocks freed.
+ */
+static size_t
+flush_parked(void)
+{
+	struct quick_bin *bin;
+	uint64_t top, off;
+	size_t n, flushed = drain_deferred();
+	char *bp;
+	int region, q;
+
+	for (region = 0; region < 2; region++) {
+		for (q = 0; q < NQUICK; q++) {
+			bin = &quick_bins[region][q];
+			top = atomic_load_explicit(&bin->top,
+			    memory_order_acquire);
+			while (QUICK_OFF(top) != 0 &&
+			    !atomic_compare_exchange_weak_explicit(&bin->top,
+			    &top, QUICK_TOP(top, 0), memory_order_acquire,
+			    memory_order_acquire))
+				;
+			for (n = 0, off = QUICK_OFF(top); off != 0; n++) {
+				bp = quick_base + off * DSIZE;
+				off = __atomic_load_n((uint64_t *)bp,
+				    __ATOMIC_RELAXED);
+				free_block(bp);
+			}
+			atomic_fetch_sub_explicit(&bin->count, n,
+			    memory_order_relaxed);
+			flushed += n;
+		}
+	}
+	return (flushed);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   The maintenance thread.  Every maint_period milliseconds, or when
+ *   woken, frees the deferred blocks.  If nothing else happened since the
+ *   last pass, also flushes the quick bins, purges, and trims the heap.
+ *   Runs until maint_on is cleared.
+ */
+static void *
+maint_main(void *arg)
+{
+	struct timespec deadline;
+	size_t last = 0;
+
+	(void)arg;
+	pthread_mutex_lock(&maint_lock);
+	while (atomic_load(&maint_on)) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += maint_period / 1000;
+		deadline.tv_nsec += (long)(maint_period % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		if (atomic_load(&deferred_count) < DEFER_WAKE)
+			pthread_cond_timedwait(&maint_wake, &maint_lock,
+			    &deadline);
+		pthread_mutex_unlock(&maint_lock);
+
+		HEAP_LOCK();
+		if (drain_deferred() == 0 && maint_activity() == last) {
+			flush_parked();
+			purge_free();
+			trim_heap(TRIM_MIN);
+		}
+		last = maint_activity();
+		HEAP_UNLOCK();
+
+		/* Pushes that reach DEFER_WAKE from now on wake it again. */
+		atomic_store(&maint_kicked, false);
+
+		pthread_mutex_lock(&maint_lock);
+	}
+	pthread_mutex_unlock(&maint_lock);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   The heap lock is held.
+ *
+ * Effects:
+ *   Returns a count that changes whenever any thread allocates or frees.
+ */
+static size_t
+maint_activity(void)
+{
+	size_t total = op_clock;
+	int i;
+
+	for (i = 0; i < NCOUNTS; i++)
+		total += atomic_load(&thread_counts[i].quick_hits) +
+		    atomic_load(&thread_counts[i].quick_frees) +
+		    atomic_load(&thread_counts[i].deferred_frees);
+	return (total);
+}
+#endif
+
+/* 
+ * The remaining routines are heap consistency checker routines. 
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns true if "p" is one of the dummy heads in array_heads or
+ *   long_heads.
+ */
+static bool
+is_head(void *p)
+{
+	struct freeHead *h = p;
+
+	return ((h >= array_heads && h < array_heads + free_list_size) ||
+	    (h >= long_heads && h < long_heads + free_list_size));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns true if "p" could be a free list node: a dummy head or a
+ *   doubleword-aligned address inside the heap.
+ */
+static bool
+is_node(void *p)
+{
+
+	return (is_head(p) || ((uintptr_t)p % DSIZE == 0 &&
+	    (char *)p > (char *)heap_listp &&
+	    (char *)p < (char *)mem_heap_hi()));
+}
+
+/*
+ * Requires:
+ *   "bp" is a doubleword-aligned address in the heap.
+ *
+ * Effects:
+ *   Returns true if the header at "bp" has a size that a block could have
+ *   there, so that NEXT_BLKP(bp) is safe to follow.
+ */
+static bool
+size_ok(void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+
+	return (size >= 2 * DSIZE &&
+	    (char *)bp + size <= (char *)mem_heap_hi() + 1);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block other than the prologue and epilogue.
+ *
+ * Effects:
+ *   Check the block "bp": its alignment, size, and boundary tags, and if
+ *   it is free, that it is linked into its bin's list between neighbors
+ *   of the same bin and region and that the block after it is not a free
+ *   block it should have been coalesced with.  Together with check_head,
+ *   checking every block checks every list.  Prints each problem found
+ *   and returns their number.
+ */
+static int
 checkblock(void *bp) 
 {
+	struct freeBlock *fb = bp, *p;
+	size_t size = GET_SIZE(HDRP(bp));
+	uintptr_t region = GET_REGION(HDRP(bp));
+	int errors = 0, index, i;
 
-	if ((uintptr_t)bp % DSIZE)
+	if ((uintptr_t)bp % DSIZE) {
 		printf("Error: %p is not doubleword aligned\n", bp);
-	if (GET(HDRP(bp)) != GET(FTRP(bp)))
-		printf("Error: header does not match footer\n");
+		return (1);
+	}
+	if (!size_ok(bp)) {
+		printf("Error: %p has bad size %zu\n", bp, size);
+		return (1);
+	}
+	if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+		printf("Error: %p header does not match footer\n", bp);
+		errors++;
+	}
+	if (GET_ALLOC(HDRP(bp)))
+		return (errors);
+
+	if (!GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+		printf("Error: free blocks %p and %p are not coalesced\n",
+		    bp, NEXT_BLKP(bp));
+		errors++;
+	}
+	if (GET_INDEX(size) != MIN_INDEX && fb->size != size) {
+		printf("Error: free block %p has inline size %zu\n", bp,
+		    fb->size);
+		errors++;
+	}
+	if (!is_node(fb->prev) || !is_node(fb->next)) {
+		printf("Error: free block %p has bad links\n", bp);
+		return (errors + 1);
+	}
+	if (fb->prev->next != fb || fb->next->prev != fb) {
+		printf("Error: free block %p is not linked in\n", bp);
+		errors++;
+	}
+	index = GET_INDEX(size);
+	for (i = 0; i < 2; i++) {
+		p = (i == 0) ? fb->prev : fb->next;
+		if (is_head(p) ? p != REGION_HEAD(region, index) :
+		    GET_ALLOC(HDRP(p)) || GET_REGION(HDRP(p)) != region ||
+		    GET_INDEX(GET_SIZE(HDRP(p))) != index) {
+			printf("Error: free block %p is in the wrong list\n",
+			    bp);
+			errors++;
+			break;
+		}
+	}
+	return (errors);
+}
+
+/*
+ * Requires:
+ *   "i" is the index of a head, as for HEAD(i).
+ *
+ * Effects:
+ *   Check that the dummy head "i" is linked to its neighbors.  Prints
+ *   each problem found and returns their number.
+ */
+static int
+check_head(int i)
+{
+	struct freeBlock *head = HEAD(i);
+
+	if (!is_node(head->prev) || !is_node(head->next) ||
+	    head->prev->next != head || head->next->prev != head) {
+		printf("Error: free list %d has bad links\n", i);
+		return (1);
+	}
+	return (0);
 }
 
 /* 
@@ -634,33 +2409,99 @@ checkblock(void *bp)
  *   None.
  *
  * Effects:
- *   Perform a minimal check of the heap for consistency. 
+ *   Check the whole heap for consistency: the prologue and epilogue,
+ *   every block as checkblock does, every dummy head, and that the free
+ *   lists hold exactly the free blocks.  If "verbose" is true, print
+ *   every block.  Prints each problem found and returns their number.
  */
-void
+static int
 checkheap(bool verbose) 
 {
-    //modify it to go through the lists and check every block in the list to check that
-    //header and footer match, and check that the "end" points back to the "dummy-head"
+	struct freeBlock *current;
+	size_t nfree = 0, nlisted = 0;
+	int errors = 0, i;
 	void *bp;
 
 	if (verbose)
 		printf("Heap (%p):\n", heap_listp);
 
 	if (GET_SIZE(HDRP(heap_listp)) != DSIZE ||
-	    !GET_ALLOC(HDRP(heap_listp)))
+	    !GET_ALLOC(HDRP(heap_listp)) ||
+	    GET(HDRP(heap_listp)) != GET(FTRP(heap_listp))) {
 		printf("Bad prologue header\n");
-	checkblock(heap_listp);
+		errors++;
+	}
 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+	for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0;
+	    bp = NEXT_BLKP(bp)) {
 		if (verbose)
 			printblock(bp);
-		checkblock(bp);
+		if ((i = checkblock(bp)) > 0) {
+			errors += i;
+			/* A bad size leaves no way to find the next block. */
+			if (!size_ok(bp))
+				return (errors);
+		}
+		if (!GET_ALLOC(HDRP(bp)))
+			nfree++;
 	}
 
 	if (verbose)
 		printblock(bp);
-	if (GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp)))
+	if (GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp)) ||
+	    (char *)bp != (char *)mem_heap_hi() + 1) {
 		printf("Bad epilogue header\n");
+		errors++;
+	}
+
+	/* Each list must lead back to its head without revisiting a block. */
+	for (i = 0; i < 2 * free_list_size; i++) {
+		if (check_head(i) > 0) {
+			errors++;
+			continue;
+		}
+		for (current = HEAD(i)->next; current != HEAD(i) &&
+		    nlisted <= nfree; current = current->next)
+			nlisted++;
+	}
+	if (nlisted != nfree) {
+		printf("Error: %zu free blocks but %s%zu in free lists\n",
+		    nfree, (nlisted > nfree) ? "over " : "", nlisted);
+		errors++;
+	}
+	return (errors);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check the next check_window blocks after check_cursor and one dummy
+ *   head, wrapping around to the start of the heap, and add any problems
+ *   found to the statistics.
+ */
+static void
+check_step(void)
+{
+	int errors, n;
+
+	for (n = 0; n < check_window; n++) {
+		if (check_cursor == NULL || GET_SIZE(HDRP(check_cursor)) == 0)
+			check_cursor = NEXT_BLKP(heap_listp);
+		if (GET_SIZE(HDRP(check_cursor)) == 0)
+			break;
+		if ((errors = checkblock(check_cursor)) > 0) {
+			stats.check_errors += errors;
+			if (!size_ok(check_cursor)) {
+				check_cursor = NULL;
+				break;
+			}
+		}
+		check_cursor = NEXT_BLKP(check_cursor);
+	}
+	check_next_head = (check_next_head + 1) % (2 * free_list_size);
+	stats.check_errors += check_head(check_next_head);
 }
 
 /*
@@ -676,7 +2517,6 @@ printblock(void *bp)
 	size_t hsize, fsize;
 	bool halloc, falloc;
 
-	checkheap(false);
 	hsize = GET_SIZE(HDRP(bp));
 	halloc = GET_ALLOC(HDRP(bp));  
 	fsize = GET_SIZE(FTRP(bp));
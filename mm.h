@@ -7,6 +7,144 @@ void	*mm_malloc(size_t size);
 void	 mm_free(void *ptr);
 void	*mm_realloc(void *ptr, size_t size);
 
+/*
+ * Lifetime hints for mm_malloc_hint.  Short- and long-lived blocks are
+ * kept in separate heap regions; a hint of 0 lets the allocator guess.
+ */
+#define	MM_SHORT_LIVED	0x1
+#define	MM_LONG_LIVED	0x2
+
+void	*mm_malloc_hint(size_t size, int hint);
+
+/* Align blocks of a huge page or more to huge pages (off by default). */
+void	 mm_set_hugepage_align(int enable);
+
+/*
+ * Memory budget.  With a budget set, the heap never grows past "bytes".
+ * When an allocation would take it past, the allocator frees its caches
+ * and compacts, then calls "cb" with the size of the block it needs; what
+ * the callback frees helps only if it forms a free block that large.  The
+ * budget counts the heap's size, not its resident pages.  The callback may free memory, with mm_free too (the heap lock
+ * is held, in threaded builds), and returns nonzero to have the allocator
+ * try again.  If the allocation still does not fit, mm_malloc returns
+ * NULL.  A budget of 0 (the default) means no limit.
+ */
+typedef int (*mm_pressure_fn)(size_t bytes);
+
+void	 mm_set_budget(size_t bytes, mm_pressure_fn cb);
+
+/*
+ * Movable blocks.  A handle names a block that mm_compact (or any later
+ * allocation) may relocate; mm_hderef returns its current address.  The
+ * handle 0 is never valid.
+ */
+typedef size_t mm_handle_t;
+
+mm_handle_t mm_halloc(size_t size);
+void	*mm_hderef(mm_handle_t h);
+void	 mm_hfree(mm_handle_t h);
+size_t	 mm_compact(void);
+
+/*
+ * Allocator statistics.  The counts are cumulative since mm_init; the
+ * byte totals describe the heap at the time of the mm_get_stats call.
+ */
+#define	MM_NBINS	26	/* Number of free list size classes */
+#define	MM_HIST		16	/* Buckets in a log2 histogram */
+#define	MM_NSLOW	8	/* Slow operations kept of each kind */
+
+/*
+ * One allocation request that took a slow path.  "op" counts the mm_malloc
+ * and mm_free calls before it since mm_init; a realloc that moves its block
+ * counts as one of each.
+ */
+struct mm_slow_op {
+	size_t	op;			/* Request number */
+	size_t	size;			/* Adjusted block size requested */
+	unsigned int nodes;		/* Free list nodes find_fit visited */
+	unsigned int bins;		/* Bins find_fit scanned */
+};
+
+struct mm_stats {
+	size_t	fit_hits[MM_NBINS];	/* find_fit successes, by bin */
+	size_t	fit_misses;		/* find_fit failures */
+	/*
+	 * find_fit calls by nodes visited and by bins scanned.  Bucket 0
+	 * counts calls that visited none; bucket i > 0, calls that visited
+	 * from 2^(i-1) to 2^i - 1.  The last bucket also takes anything more.
+	 */
+	size_t	fit_nodes[MM_HIST];
+	size_t	fit_bins[MM_HIST];
+	struct mm_slow_op longest_fits[MM_NSLOW]; /* Longest searches first */
+	size_t	splits;			/* Free blocks split by place */
+	size_t	coalesces[4];		/* coalesce calls, by case (1-4) */
+	size_t	steals;			/* Fits taken from the other region */
+	size_t	pressure_events;	/* Allocations that hit the budget */
+	size_t	budget_failures;	/* Of those, allocations that failed */
+	size_t	extends;		/* extend_heap calls */
+	size_t	extend_bins[MM_NBINS];	/* Extending requests, by bin */
+	struct mm_slow_op first_extends[MM_NSLOW]; /* The first of them */
+	size_t	sbrk_bytes;		/* Bytes ever added by mem_sbrk */
+	size_t	heap_bytes;		/* Current heap size */
+	size_t	live_bytes;		/* Bytes in allocated blocks */
+	size_t	free_bytes[MM_NBINS];	/* Bytes in free blocks, by bin */
+	size_t	largest_free;		/* Size of the largest free block */
+	double	frag;			/* 1 - largest_free / total free bytes */
+	size_t	check_errors;		/* Problems found by the heap checkers */
+	size_t	quick_hits;		/* Allocations from the quick bins */
+	size_t	quick_frees;		/* Blocks freed into the quick bins */
+	size_t	deferred_frees;		/* Blocks handed to maintenance */
+	size_t	trim_bytes;		/* Bytes trimmed from the heap's end */
+};
+
+void	 mm_get_stats(struct mm_stats *st);
+
+/*
+ * Thread safety.  Built with -DMM_THREADS (make THREADS=1), every function
+ * here may be called from any thread.  Small blocks are freed into and
+ * reused from lock-free quick bins; everything else takes one heap lock.
+ * Small allocations without a hint may come from either region, and the
+ * incremental checker only runs on operations that take the lock.  Quick
+ * bins are not used for blocks more than 64 GB into the heap.
+ */
+
+/*
+ * Background maintenance, in threaded builds only.  While the maintenance
+ * thread runs, mm_free hands blocks it cannot put in a quick bin to the
+ * thread instead of coalescing them itself.  The thread frees them every
+ * "period_ms" milliseconds and tidies the heap when the allocator is idle.
+ * mm_start_maintenance returns 0 on success and -1 otherwise.  Start the
+ * thread only after mm_init, and stop it before the memory system is
+ * reset.  Neither may be called concurrently with mm_init.  mm_init may
+ * be called while the thread runs: it keeps the thread out while it
+ * rebuilds the heap, and drops any blocks still queued along with the
+ * old heap.
+ */
+int	 mm_start_maintenance(unsigned int period_ms);
+void	 mm_stop_maintenance(void);
+
+/*
+ * Heap checking.  mm_set_check(n) checks n blocks after every operation,
+ * cycling through the heap, at a fixed cost per operation; 0 (the default)
+ * turns it off.  mm_checkheap checks the whole heap at once and returns
+ * the number of problems found.
+ */
+void	 mm_set_check(int window);
+int	 mm_checkheap(int verbose);
+
+/*
+ * Heap profiling.  With a nonzero interval, about one allocation per
+ * "interval" bytes allocated has its call stack recorded until it is
+ * freed; 0 (the default) turns sampling off.  mm_prof_dump writes the
+ * sampled stacks as a pprof heap profile, or as folded stacks of the
+ * estimated bytes live (or ever allocated, with MM_PROF_CUMULATIVE).
+ */
+#define	MM_PROF_FOLDED		0x1
+#define	MM_PROF_CUMULATIVE	0x2
+
+void	 mm_prof_set_interval(size_t interval);
+int	 mm_prof_dump(const char *path, int flags);
+
 /*
  * Students work in teams of one or two.  Teams enter their team name, personal
  * names and login IDs in a struct of this type in their mm.c file.
@@ -0,0 +1,72 @@
+/*
+ * mmdecode.c - print an allocator event trace written by mmtrace_dump()
+ *
+ * Usage: mmdecode <file>
+ *
+ * Prints one line per event: its sequence number, the time since the
+ * first event in microseconds, the event type, size, block address, free
+ * list index, and the number of free list nodes searched (for malloc) or
+ * the boundary tag case (for coalesce).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmtrace.h"
+
+static const char *op_names[] = {
+    "?", "malloc", "free", "realloc", "extend", "coalesce", "compact", "purge"
+};
+
+int main(int argc, char **argv)
+{
+    struct mmtrace_hdr hdr;
+    struct mmtrace_rec rec;
+    uint64_t i, t0 = 0;
+    const char *name;
+    FILE *fp;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: mmdecode <file>\n");
+	exit(1);
+    }
+    if ((fp = fopen(argv[1], "rb")) == NULL) {
+	perror(argv[1]);
+	exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	hdr.magic != MMTRACE_MAGIC) {
+	fprintf(stderr, "%s: not an mmtrace file\n", argv[1]);
+	exit(1);
+    }
+    if (hdr.version != MMTRACE_VERSION ||
+	hdr.rec_size != sizeof(struct mmtrace_rec)) {
+	fprintf(stderr, "%s: unsupported mmtrace version %u\n",
+		argv[1], hdr.version);
+	exit(1);
+    }
+
+    printf("# %llu events (%llu earlier events overwritten)\n",
+	   (unsigned long long)hdr.count, (unsigned long long)hdr.dropped);
+    printf("%10s %12s %-9s %10s %18s %4s %6s\n",
+	   "seq", "usec", "op", "size", "addr", "bin", "search");
+    for (i = 0; i < hdr.count; i++) {
+	if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+	    fprintf(stderr, "%s: truncated after %llu events\n",
+		    argv[1], (unsigned long long)i);
+	    exit(1);
+	}
+	if (i == 0)
+	    t0 = rec.time;
+	name = (rec.op < sizeof(op_names) / sizeof(op_names[0])) ?
+	    op_names[rec.op] : "?";
+	printf("%10llu %12.3f %-9s %10u %#18llx %4d %6u\n",
+	       (unsigned long long)(hdr.dropped + i),
+	       hdr.time_hz ? (rec.time - t0) * 1e6 / hdr.time_hz : 0.0,
+	       name, rec.size, (unsigned long long)rec.addr,
+	       rec.bin, rec.search);
+    }
+    fclose(fp);
+    return 0;
+}
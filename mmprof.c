@@ -0,0 +1,431 @@
+/*
+ * mmprof.c - sampled heap profiler
+ *
+ * Each sample records the call stack of one allocation.  Distinct stacks
+ * are kept once each in "stacks", with the number and requested bytes of
+ * their sampled allocations, both cumulative and still live.  The live
+ * samples themselves are kept in "samples", an open-addressed hash table
+ * keyed by block address, so that a free or a move can find the stack to
+ * charge.  Both tables are mmap'ed and double when they fill; if that
+ * fails, the sample is dropped.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+#include "mmprof.h"
+
+#define PROF_DEPTH  32        /* Most frames kept per stack */
+#define PROF_SKIP   1         /* Frames of mmprof_sample itself */
+#define PROF_SLOTS  1024      /* Initial size of each hash table */
+
+#define EMPTY       0         /* Address of an unused sample slot */
+#define DELETED     1         /* Address of a freed sample slot */
+
+struct prof_stack {
+    uint64_t hash;
+    int depth;
+    void *pc[PROF_DEPTH];     /* Return addresses, innermost first */
+    size_t live_objs;         /* Sampled allocations not yet freed */
+    size_t live_bytes;
+    size_t alloc_objs;        /* Sampled allocations ever made */
+    size_t alloc_bytes;
+};
+
+struct prof_sample {
+    uintptr_t addr;           /* Block address, EMPTY, or DELETED */
+    size_t size;              /* Bytes requested */
+    uint32_t stack;           /* Index in stacks */
+};
+
+intptr_t mmprof_countdown = INTPTR_MAX;
+size_t mmprof_live;
+
+static size_t prof_interval;          /* Mean bytes between samples, or 0 */
+static size_t prof_rate;              /* Last nonzero prof_interval */
+static uint64_t prof_rng = 0x9e3779b97f4a7c15;
+
+static struct prof_stack *stacks;     /* Distinct stacks */
+static size_t nstacks, stacks_cap;
+static uint32_t *stack_index;         /* Hash of stacks; 0 or index + 1 */
+static size_t stack_index_cap;
+
+static struct prof_sample *samples;   /* Hash of live samples by address */
+static size_t samples_cap, samples_used; /* used counts DELETED slots too */
+
+/*
+ * prof_map - map "bytes" of zeroed memory, or return NULL
+ */
+static void *prof_map(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/*
+ * prof_hash - mix the bits of "x"
+ */
+static inline uint64_t prof_hash(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+ * prof_gap - draw the number of bytes until the next sample
+ */
+static intptr_t prof_gap(void)
+{
+    double u, gap;
+
+    /* xorshift64* gives a uniform u in (0, 1] */
+    prof_rng ^= prof_rng >> 12;
+    prof_rng ^= prof_rng << 25;
+    prof_rng ^= prof_rng >> 27;
+    u = ((prof_rng * 0x2545f4914f6cdd1dULL >> 11) + 1) / 9007199254740992.0;
+
+    gap = -log(u) * prof_interval;
+    if (gap < 1)
+	return 1;
+    if (gap > INTPTR_MAX / 2)
+	return INTPTR_MAX / 2;
+    return (intptr_t)gap;
+}
+
+/*
+ * sample_slot - return the slot holding "addr", or the slot where it
+ *     would be inserted
+ */
+static struct prof_sample *sample_slot(uintptr_t addr)
+{
+    size_t i = prof_hash(addr) & (samples_cap - 1);
+    struct prof_sample *tomb = NULL;
+
+    for (;; i = (i + 1) & (samples_cap - 1)) {
+	if (samples[i].addr == addr)
+	    return &samples[i];
+	if (samples[i].addr == DELETED && tomb == NULL)
+	    tomb = &samples[i];
+	else if (samples[i].addr == EMPTY)
+	    return (tomb != NULL) ? tomb : &samples[i];
+    }
+}
+
+/*
+ * samples_grow - rehash the live samples into a table with room for more.
+ *     Returns 0 on success and -1 if no memory is left.
+ */
+static int samples_grow(void)
+{
+    struct prof_sample *old = samples;
+    size_t i, old_cap = samples_cap;
+    size_t cap = (old_cap == 0) ? PROF_SLOTS :
+	(mmprof_live * 4 > old_cap) ? 2 * old_cap : old_cap;
+
+    if ((samples = prof_map(cap * sizeof(*samples))) == NULL) {
+	samples = old;
+	return -1;
+    }
+    samples_cap = cap;
+    samples_used = 0;
+    for (i = 0; i < old_cap; i++) {
+	if (old[i].addr != EMPTY && old[i].addr != DELETED) {
+	    *sample_slot(old[i].addr) = old[i];
+	    samples_used++;
+	}
+    }
+    if (old != NULL)
+	munmap(old, old_cap * sizeof(*old));
+    return 0;
+}
+
+/*
+ * find_stack - return the index of the stack "pc[0..depth-1]", adding it
+ *     if it is new, or -1 if no memory is left
+ */
+static long find_stack(void **pc, int depth)
+{
+    uint64_t hash = depth;
+    struct prof_stack *st;
+    uint32_t *index;
+    size_t i, j, cap;
+    int d;
+
+    for (d = 0; d < depth; d++)
+	hash = prof_hash(hash ^ (uintptr_t)pc[d]);
+
+    for (i = hash & (stack_index_cap - 1); stack_index_cap > 0 &&
+	     stack_index[i] != 0; i = (i + 1) & (stack_index_cap - 1)) {
+	st = &stacks[stack_index[i] - 1];
+	if (st->hash == hash && st->depth == depth &&
+	    memcmp(st->pc, pc, depth * sizeof(void *)) == 0)
+	    return stack_index[i] - 1;
+    }
+
+    /* A new stack; keep the index at most half full. */
+    if (nstacks == stacks_cap) {
+	cap = (stacks_cap == 0) ? PROF_SLOTS : 2 * stacks_cap;
+	if ((st = prof_map(cap * sizeof(*st))) == NULL)
+	    return -1;
+	if (stacks != NULL) {
+	    memcpy(st, stacks, nstacks * sizeof(*st));
+	    munmap(stacks, stacks_cap * sizeof(*st));
+	}
+	stacks = st;
+	stacks_cap = cap;
+    }
+    if (2 * (nstacks + 1) > stack_index_cap) {
+	cap = (stack_index_cap == 0) ? PROF_SLOTS : 2 * stack_index_cap;
+	if ((index = prof_map(cap * sizeof(*index))) == NULL)
+	    return -1;
+	if (stack_index != NULL)
+	    munmap(stack_index, stack_index_cap * sizeof(*index));
+	stack_index = index;
+	stack_index_cap = cap;
+	for (j = 0; j < nstacks; j++) {
+	    for (i = stacks[j].hash & (cap - 1); stack_index[i] != 0;
+		 i = (i + 1) & (cap - 1))
+		;
+	    stack_index[i] = j + 1;
+	}
+	for (i = hash & (cap - 1); stack_index[i] != 0; i = (i + 1) & (cap - 1))
+	    ;
+    }
+
+    st = &stacks[nstacks];
+    memset(st, 0, sizeof(*st));
+    st->hash = hash;
+    st->depth = depth;
+    memcpy(st->pc, pc, depth * sizeof(void *));
+    stack_index[i] = ++nstacks;
+    return nstacks - 1;
+}
+
+/*
+ * mmprof_set_interval - sample about once per "interval" bytes allocated,
+ *     or stop sampling if "interval" is 0
+ */
+void mmprof_set_interval(size_t interval)
+{
+    void *pc[1];
+
+    prof_interval = interval;
+    if (interval == 0) {
+	mmprof_countdown = INTPTR_MAX;
+	return;
+    }
+
+    /* The first backtrace() loads the unwinder, which calls malloc. */
+    backtrace(pc, 1);
+    prof_rate = interval;
+    mmprof_countdown = prof_gap();
+}
+
+/*
+ * mmprof_sample - record the allocation of "size" bytes at "addr" and
+ *     restart the countdown
+ */
+void mmprof_sample(void *addr, size_t size)
+{
+    void *pc[PROF_DEPTH + PROF_SKIP];
+    struct prof_sample *s;
+    struct prof_stack *st;
+    long stack;
+    int depth;
+
+    if (prof_interval == 0) {
+	mmprof_countdown = INTPTR_MAX;
+	return;
+    }
+    mmprof_countdown = prof_gap();
+
+    depth = backtrace(pc, PROF_DEPTH + PROF_SKIP) - PROF_SKIP;
+    if ((stack = find_stack(pc + PROF_SKIP, depth > 0 ? depth : 0)) < 0)
+	return;
+    if (2 * (samples_used + 1) > samples_cap && samples_grow() < 0)
+	return;
+
+    st = &stacks[stack];
+    st->alloc_objs++;
+    st->alloc_bytes += size;
+    st->live_objs++;
+    st->live_bytes += size;
+
+    s = sample_slot((uintptr_t)addr);
+    if (s->addr == EMPTY)
+	samples_used++;
+    s->addr = (uintptr_t)addr;
+    s->size = size;
+    s->stack = stack;
+    mmprof_live++;
+}
+
+/*
+ * mmprof_free - forget the sample at "addr", if there is one
+ */
+void mmprof_free(void *addr)
+{
+    struct prof_sample *s = sample_slot((uintptr_t)addr);
+    struct prof_stack *st;
+
+    if (s->addr != (uintptr_t)addr)
+	return;
+    st = &stacks[s->stack];
+    st->live_objs--;
+    st->live_bytes -= s->size;
+    s->addr = DELETED;
+    mmprof_live--;
+}
+
+/*
+ * mmprof_move - note that the block at "from", if sampled, is now at "to".
+ *     The sample is forgotten if the table is full and cannot grow.
+ */
+void mmprof_move(void *from, void *to)
+{
+    struct prof_sample *s = sample_slot((uintptr_t)from);
+    struct prof_sample moved;
+    struct prof_stack *st;
+
+    if (s->addr != (uintptr_t)from)
+	return;
+    moved = *s;
+    s->addr = DELETED;
+    moved.addr = (uintptr_t)to;
+    if (2 * (samples_used + 1) > samples_cap && samples_grow() < 0) {
+	st = &stacks[moved.stack];
+	st->live_objs--;
+	st->live_bytes -= moved.size;
+	mmprof_live--;
+	return;
+    }
+    s = sample_slot((uintptr_t)to);
+    if (s->addr == EMPTY)
+	samples_used++;
+    *s = moved;
+}
+
+/*
+ * mmprof_reset_live - forget every live sample, keeping the cumulative
+ *     counts; used when the heap is reinitialized
+ */
+void mmprof_reset_live(void)
+{
+    size_t i;
+
+    for (i = 0; i < nstacks; i++) {
+	stacks[i].live_objs = 0;
+	stacks[i].live_bytes = 0;
+    }
+    if (samples != NULL)
+	memset(samples, 0, samples_cap * sizeof(*samples));
+    samples_used = 0;
+    mmprof_live = 0;
+}
+
+/*
+ * prof_scale - estimate the bytes that "objs" samples of "bytes" stand for.
+ *     An allocation of s bytes is sampled with probability 1 - e^(-s/R).
+ */
+static double prof_scale(size_t objs, size_t bytes)
+{
+    double avg;
+
+    if (objs == 0 || prof_rate == 0)
+	return bytes;
+    avg = (double)bytes / objs;
+    return bytes / (1.0 - exp(-avg / prof_rate));
+}
+
+/*
+ * dump_folded - write one line per stack, outermost frame first, followed
+ *     by the estimated bytes live (or ever allocated, if "cumulative")
+ */
+static void dump_folded(FILE *fp, int cumulative)
+{
+    struct prof_stack *st;
+    Dl_info info;
+    size_t i;
+    int d;
+
+    for (i = 0; i < nstacks; i++) {
+	st = &stacks[i];
+	if ((cumulative ? st->alloc_objs : st->live_objs) == 0)
+	    continue;
+	for (d = st->depth - 1; d >= 0; d--) {
+	    if (dladdr(st->pc[d], &info) && info.dli_sname != NULL)
+		fprintf(fp, "%s", info.dli_sname);
+	    else
+		fprintf(fp, "%p", st->pc[d]);
+	    fputc(d > 0 ? ';' : ' ', fp);
+	}
+	fprintf(fp, "%.0f\n", cumulative ?
+		prof_scale(st->alloc_objs, st->alloc_bytes) :
+		prof_scale(st->live_objs, st->live_bytes));
+    }
+}
+
+/*
+ * dump_pprof - write the legacy text heap profile that pprof reads,
+ *     followed by the address space map it needs to symbolize it
+ */
+static void dump_pprof(FILE *fp)
+{
+    size_t i, live_objs = 0, live_bytes = 0, alloc_objs = 0, alloc_bytes = 0;
+    struct prof_stack *st;
+    char buf[4096];
+    size_t n;
+    FILE *maps;
+    int d;
+
+    for (i = 0; i < nstacks; i++) {
+	live_objs += stacks[i].live_objs;
+	live_bytes += stacks[i].live_bytes;
+	alloc_objs += stacks[i].alloc_objs;
+	alloc_bytes += stacks[i].alloc_bytes;
+    }
+    fprintf(fp, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+	    live_objs, live_bytes, alloc_objs, alloc_bytes, prof_rate);
+    for (i = 0; i < nstacks; i++) {
+	st = &stacks[i];
+	fprintf(fp, "%zu: %zu [%zu: %zu] @", st->live_objs, st->live_bytes,
+		st->alloc_objs, st->alloc_bytes);
+	for (d = 0; d < st->depth; d++)
+	    fprintf(fp, " %p", st->pc[d]);
+	fputc('\n', fp);
+    }
+
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL) {
+	while ((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+	    fwrite(buf, 1, n, fp);
+	fclose(maps);
+    }
+}
+
+/*
+ * mmprof_dump - write the profile to "path" in the format chosen by
+ *     "flags".  Returns 0 on success and -1 on error.
+ */
+int mmprof_dump(const char *path, int flags)
+{
+    FILE *fp;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	return -1;
+    if (flags & MM_PROF_FOLDED)
+	dump_folded(fp, flags & MM_PROF_CUMULATIVE);
+    else
+	dump_pprof(fp);
+    return (ferror(fp) | fclose(fp)) ? -1 : 0;
+}
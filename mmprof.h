@@ -0,0 +1,45 @@
+/*
+ * mmprof.h - sampled heap profiler behind mm_prof_set_interval
+ *
+ * The allocator calls PROF_MALLOC() after each allocation.  It counts down
+ * the bytes to the next sample, and only when the count runs out records
+ * the allocation's call stack in mmprof.c.  The gaps between samples are
+ * drawn from an exponential distribution with the interval as the mean, so
+ * every allocated byte is equally likely to be sampled.  PROF_FREE() and
+ * PROF_MOVE() only look up the block while sampled blocks are live.
+ *
+ * The profiler's tables live in their own mmap'ed memory, never in the
+ * heap it profiles.
+ */
+#ifndef __MMPROF_H_
+#define __MMPROF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern intptr_t mmprof_countdown;  /* Bytes to allocate before a sample */
+extern size_t mmprof_live;         /* Sampled blocks not yet freed */
+
+void	mmprof_set_interval(size_t interval);
+void	mmprof_sample(void *addr, size_t size);
+void	mmprof_free(void *addr);
+void	mmprof_move(void *from, void *to);
+void	mmprof_reset_live(void);
+int	mmprof_dump(const char *path, int flags);
+
+#define PROF_MALLOC(addr, size) do {					\
+	if ((mmprof_countdown -= (intptr_t)(size)) < 0)			\
+		mmprof_sample((addr), (size));				\
+} while (0)
+
+#define PROF_FREE(addr) do {						\
+	if (mmprof_live > 0)						\
+		mmprof_free(addr);					\
+} while (0)
+
+#define PROF_MOVE(from, to) do {					\
+	if (mmprof_live > 0)						\
+		mmprof_move((from), (to));				\
+} while (0)
+
+#endif /* __MMPROF_H_ */
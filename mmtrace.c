@@ -0,0 +1,73 @@
+/*
+ * mmtrace.c - ring buffer behind the TRACE() macro in mmtrace.h
+ *
+ * Writers claim a slot with one atomic increment of ring_head and then
+ * fill it in, so recording never takes a lock.  If writers lap the ring
+ * while a slow one is still filling its slot, that record may be torn;
+ * the buffer is sized so that this needs MMTRACE_SLOTS events to happen
+ * during one record.
+ */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "clock.h"
+#include "mmtrace.h"
+
+static struct mmtrace_rec ring[MMTRACE_SLOTS];
+static _Atomic uint64_t ring_head;   /* Records ever claimed */
+
+/*
+ * mmtrace_record - append one event to the ring
+ */
+void mmtrace_record(int op, size_t size, const void *addr, int bin,
+    unsigned int search)
+{
+    uint64_t i = atomic_fetch_add_explicit(&ring_head, 1,
+					   memory_order_relaxed);
+    struct mmtrace_rec *r = &ring[i & (MMTRACE_SLOTS - 1)];
+
+    r->time = read_counter();
+    r->addr = (uintptr_t)addr;
+    r->size = (size > UINT32_MAX) ? UINT32_MAX : (uint32_t)size;
+    r->search = (search > UINT16_MAX) ? UINT16_MAX : (uint16_t)search;
+    r->op = (uint8_t)op;
+    r->bin = (int8_t)bin;
+}
+
+/*
+ * mmtrace_dump - write the ring to "path", oldest record first.
+ *     Returns 0 on success and -1 on error.
+ */
+int mmtrace_dump(const char *path)
+{
+    struct mmtrace_hdr hdr;
+    uint64_t head = atomic_load(&ring_head);
+    uint64_t first, i;
+    FILE *fp;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MMTRACE_MAGIC;
+    hdr.version = MMTRACE_VERSION;
+    hdr.rec_size = sizeof(struct mmtrace_rec);
+    hdr.count = (head < MMTRACE_SLOTS) ? head : MMTRACE_SLOTS;
+    hdr.dropped = head - hdr.count;
+    hdr.time_hz = (uint64_t)counter_hz();
+
+    if ((fp = fopen(path, "wb")) == NULL)
+	return -1;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+	fclose(fp);
+	return -1;
+    }
+    first = head - hdr.count;
+    for (i = first; i < head; i++) {
+	if (fwrite(&ring[i & (MMTRACE_SLOTS - 1)],
+		   sizeof(struct mmtrace_rec), 1, fp) != 1) {
+	    fclose(fp);
+	    return -1;
+	}
+    }
+    return fclose(fp);
+}
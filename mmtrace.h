@@ -0,0 +1,62 @@
+/*
+ * mmtrace.h - compile-time allocator event tracing
+ *
+ * When mm.c is compiled with -DMM_TRACE (make TRACE=1), each TRACE() call
+ * appends a fixed-size binary record to an in-memory ring buffer that
+ * keeps the most recent MMTRACE_SLOTS events.  Otherwise TRACE() compiles
+ * to nothing.  mmtrace_dump() writes the buffer to a file that mmdecode
+ * turns back into text.
+ */
+#ifndef __MMTRACE_H_
+#define __MMTRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MMTRACE_MAGIC    0x52544d4du  /* "MMTR" */
+#define MMTRACE_VERSION  1
+#define MMTRACE_SLOTS    (1 << 16)    /* must be a power of 2 */
+
+/* Event types */
+enum mmtrace_op {
+	MMT_MALLOC = 1,  /* size requested, block returned, bin, nodes searched */
+	MMT_FREE,        /* block size, block freed, bin */
+	MMT_REALLOC,     /* size requested, block returned, bin */
+	MMT_EXTEND,      /* bytes added, new free block */
+	MMT_COALESCE,    /* merged size, merged block, bin, case (1-4) */
+	MMT_COMPACT,     /* bytes trimmed */
+	MMT_PURGE        /* bytes purged, block purged, bin */
+};
+
+/* One event.  The layout is the file format; change MMTRACE_VERSION too. */
+struct mmtrace_rec {
+	uint64_t time;    /* read_counter() at the event */
+	uint64_t addr;    /* block address */
+	uint32_t size;    /* byte count, saturated at UINT32_MAX */
+	uint16_t search;  /* free list nodes visited, saturated at UINT16_MAX */
+	uint8_t  op;      /* enum mmtrace_op */
+	int8_t   bin;     /* free list index, or -1 */
+};
+
+/* File header, followed by "count" records, oldest first */
+struct mmtrace_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;   /* sizeof(struct mmtrace_rec) */
+	uint64_t count;      /* records in the file */
+	uint64_t dropped;    /* older records overwritten in the ring */
+	uint64_t time_hz;    /* read_counter() ticks per second, 0 if unknown */
+};
+
+void	mmtrace_record(int op, size_t size, const void *addr, int bin,
+	    unsigned int search);
+int	mmtrace_dump(const char *path);
+
+#ifdef MM_TRACE
+#define TRACE(op, size, addr, bin, search) \
+	mmtrace_record((op), (size), (addr), (bin), (search))
+#else
+#define TRACE(op, size, addr, bin, search) ((void)0)
+#endif
+
+#endif /* __MMTRACE_H_ */
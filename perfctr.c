@@ -0,0 +1,177 @@
+/*
+ * perfctr.c - perf_event_open counters behind perfctr.h
+ *
+ * The counters are opened one by one rather than as a group, so that one
+ * the processor lacks does not cost the others.  If the kernel has to
+ * multiplex them, each count is scaled up by the fraction of the time it
+ * was actually counting.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perfctr.h"
+
+#ifdef __linux__
+
+#define CACHE_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+			   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+struct perfctr_event {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+};
+
+/* The events wanted, cycles first... */
+static const struct perfctr_event hw_events[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instrs"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D), "L1D-miss"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC-miss"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "br-miss"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB), "dTLB-miss"},
+};
+
+/* ... and the ones to count instead without a cycle counter */
+static const struct perfctr_event sw_events[] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-ns"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "faults"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx-sw"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "migrations"},
+};
+
+/*
+ * open_event - open a disabled counter of events "e" in this process.
+ *     Hardware events are counted in user mode only.  Software events
+ *     such as page faults happen in the kernel, so they are counted there
+ *     too if the kernel allows it.  Returns the descriptor, or -1.
+ */
+static int open_event(const struct perfctr_event *e)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e->type;
+    attr.config = e->config;
+    attr.disabled = 1;
+    attr.exclude_kernel = (e->type != PERF_TYPE_SOFTWARE);
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0 && !attr.exclude_kernel) {
+	attr.exclude_kernel = 1;
+	fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+/*
+ * open_events - open what counters of the n events "e" it can in "s".
+ *     The first must open, or none are kept.
+ */
+static void open_events(struct perfctr_set *s, const struct perfctr_event *e,
+    int n)
+{
+    int i, fd;
+
+    for (i = 0; i < n && s->n < PERFCTR_MAX; i++) {
+	if ((fd = open_event(&e[i])) < 0) {
+	    if (i == 0)
+		return;
+	    continue;
+	}
+	if (e[i].type == PERF_TYPE_HARDWARE &&
+	    e[i].config == PERF_COUNT_HW_CPU_CYCLES)
+	    s->cycles = s->n;
+	if (e[i].type == PERF_TYPE_HARDWARE &&
+	    e[i].config == PERF_COUNT_HW_INSTRUCTIONS)
+	    s->instrs = s->n;
+	s->fd[s->n] = fd;
+	s->name[s->n++] = e[i].name;
+    }
+}
+
+#endif /* __linux__ */
+
+/*
+ * perfctr_open - open the hardware counters, or else the software ones,
+ *     in "s".  Returns the number opened, which is 0 if perf_event_open
+ *     is not allowed at all.
+ */
+int perfctr_open(struct perfctr_set *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->cycles = s->instrs = -1;
+#ifdef __linux__
+    open_events(s, hw_events, sizeof(hw_events) / sizeof(hw_events[0]));
+    if (s->n == 0) {
+	s->software = 1;
+	open_events(s, sw_events, sizeof(sw_events) / sizeof(sw_events[0]));
+    }
+#endif
+    return s->n;
+}
+
+/*
+ * perfctr_start - zero the counters in "s" and start them
+ */
+void perfctr_start(struct perfctr_set *s)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < s->n; i++)
+	ioctl(s->fd[i], PERF_EVENT_IOC_RESET, 0);
+    for (i = 0; i < s->n; i++)
+	ioctl(s->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+#else
+    (void)s;
+#endif
+}
+
+/*
+ * perfctr_stop - stop the counters in "s" and store their counts, scaled
+ *     for multiplexing, in "counts"
+ */
+void perfctr_stop(struct perfctr_set *s, uint64_t *counts)
+{
+#ifdef __linux__
+    uint64_t v[3];  /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < s->n; i++)
+	ioctl(s->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < s->n; i++) {
+	if (read(s->fd[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+	    counts[i] = 0;
+	else if (v[2] < v[1])
+	    counts[i] = (uint64_t)((double)v[0] * v[1] / v[2]);
+	else
+	    counts[i] = v[0];
+    }
+#else
+    (void)s;
+    (void)counts;
+#endif
+}
+
+/*
+ * perfctr_close - close the counters in "s"
+ */
+void perfctr_close(struct perfctr_set *s)
+{
+    int i;
+
+    for (i = 0; i < s->n; i++)
+	close(s->fd[i]);
+    s->n = 0;
+}
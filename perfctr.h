@@ -0,0 +1,31 @@
+/*
+ * perfctr.h - per-process performance counters for mdriver -e
+ *
+ * perfctr_open opens one perf_event_open counter per event, counting this
+ * process.  It asks for hardware events first: cycles, instructions, L1D
+ * read misses, last-level cache misses, branch misses, and dTLB read
+ * misses, skipping any the processor lacks.  If the cycle counter cannot
+ * be opened at all, as in most containers and VMs, it falls back to the
+ * kernel's software events.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+#include <stdint.h>
+
+#define PERFCTR_MAX  6  /* most events counted at once */
+
+struct perfctr_set {
+	int n;                         /* events open */
+	int software;                  /* set if they are software events */
+	int fd[PERFCTR_MAX];
+	const char *name[PERFCTR_MAX]; /* short names for column headers */
+	int cycles, instrs;            /* which of them these are, or -1 */
+};
+
+int	perfctr_open(struct perfctr_set *s);
+void	perfctr_start(struct perfctr_set *s);
+void	perfctr_stop(struct perfctr_set *s, uint64_t *counts);
+void	perfctr_close(struct perfctr_set *s);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,133 @@
+/*
+ * trace2bin.c - convert an mdriver trace file to the binary form
+ *
+ * Usage: trace2bin <in.rep> <out>
+ *
+ * Reads a text trace (four header numbers, then one "a id size",
+ * "r id size", or "f id" request per line) and writes it in the format
+ * described in tracebin.h, which mdriver reads as readily as text.  The
+ * lines are parsed as mdriver parses them, so a trace that mdriver would
+ * reject is rejected here too, with its line number.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracebin.h"
+
+#define MAXLINE  1024
+
+static void die(const char *path, unsigned long line, const char *msg)
+{
+    if (line > 0)
+	fprintf(stderr, "%s, line %lu: %s\n", path, line, msg);
+    else
+	fprintf(stderr, "%s: %s\n", path, msg);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct tracebin_hdr hdr;
+    unsigned char buf[3 * TRACEBIN_MAXVARINT], *bp;
+    char line[MAXLINE];
+    const char *p, *end, *err;
+    unsigned header[4], type, index, size, prev = 0, ops = 0, max_index = 0;
+    unsigned long lineno = 0;
+    int i;
+    FILE *in, *out;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: trace2bin <in.rep> <out>\n");
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+	perror(argv[1]);
+	exit(1);
+    }
+    if ((out = fopen(argv[2], "wb")) == NULL) {
+	perror(argv[2]);
+	exit(1);
+    }
+
+    /*
+     * The header goes first, with data_size filled in at the end.  It is
+     * four numbers, on as many lines as they take; the rest of the line
+     * with the fourth is ignored.
+     */
+    for (i = 0; i < 4; ) {
+	if (fgets(line, sizeof(line), in) == NULL)
+	    die(argv[1], lineno + 1, "bad trace header");
+	lineno++;
+	p = line;
+	end = line + strlen(line);
+	while (i < 4) {
+	    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+			       *p == '\n'))
+		p++;
+	    if (p == end)
+		break;
+	    if (!tracebin_scan_uint(&p, end, &header[i++]))
+		die(argv[1], lineno, "bad trace header");
+	}
+    }
+    if (header[1] >= (1u << 29))
+	die(argv[1], 0, "too many ids for the binary format");
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRACEBIN_MAGIC;
+    hdr.version = TRACEBIN_VERSION;
+    hdr.hdr_size = sizeof(hdr);
+    hdr.sugg_heapsize = header[0];
+    hdr.num_ids = header[1];
+    hdr.num_ops = header[2];
+    hdr.weight = header[3];
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+	perror(argv[2]);
+	exit(1);
+    }
+
+    /* Then each request */
+    while (fgets(line, sizeof(line), in) != NULL) {
+	lineno++;
+	end = line + strlen(line);
+	if (end > line && end[-1] != '\n' && !feof(in))
+	    die(argv[1], lineno, "line too long");
+	for (p = line; p < end && (*p == ' ' || *p == '\t' || *p == '\r'); p++)
+	    ;
+	if (p == end || *p == '\n')
+	    continue;  /* blank line */
+	if ((err = tracebin_parse_line(&p, end, header[1], &type, &index,
+				       &size)) != NULL)
+	    die(argv[1], lineno, err);
+	bp = tracebin_put(buf, TRACEBIN_ZIGZAG((int32_t)(index - prev)) << 2 |
+			  type);
+	if (type != TB_FREE)
+	    bp = tracebin_put(bp, size);
+	if (fwrite(buf, bp - buf, 1, out) != 1) {
+	    perror(argv[2]);
+	    exit(1);
+	}
+	hdr.data_size += bp - buf;
+	if (type != TB_FREE && index > max_index)
+	    max_index = index;
+	prev = index;
+	ops++;
+    }
+    if (ferror(in)) {
+	perror(argv[1]);
+	exit(1);
+    }
+    if (ops != header[2])
+	die(argv[1], 0, "request count differs from the header");
+    if (ops > 0 && max_index != header[1] - 1)
+	die(argv[1], 0, "largest id differs from the header's id count");
+
+    rewind(out);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 || fclose(out) != 0) {
+	perror(argv[2]);
+	exit(1);
+    }
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * tracebin.h - compact binary form of mdriver's trace files
+ *
+ * A binary trace is a struct tracebin_hdr followed by "data_size" bytes of
+ * encoded requests.  Each request starts with an unsigned LEB128 varint
+ * holding the zigzag-encoded difference between its id and the previous
+ * request's id (the first is taken against id 0), shifted left two bits,
+ * with the request type in the low two bits.  An allocation or
+ * reallocation is followed by a second varint holding its size.  Ids
+ * usually change by small amounts, so most requests take two to four
+ * bytes.  trace2bin converts text traces to this form; mdriver recognizes
+ * it by its magic number and replays it straight from the mapped file.
+ *
+ * The parser for the lines of a text trace is here too, so that mdriver
+ * and trace2bin accept exactly the same traces.
+ */
+#ifndef __TRACEBIN_H_
+#define __TRACEBIN_H_
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACEBIN_MAGIC    0x42544d4du  /* "MMTB" */
+#define TRACEBIN_VERSION  1
+
+/* Request types, in the low bits of each request's first varint */
+enum tracebin_type {
+	TB_ALLOC = 0,
+	TB_FREE,
+	TB_REALLOC
+};
+
+/* File header.  The layout is the file format; change TRACEBIN_VERSION too. */
+struct tracebin_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hdr_size;       /* sizeof(struct tracebin_hdr) */
+	uint32_t sugg_heapsize;  /* the text header's four numbers */
+	uint32_t num_ids;
+	uint32_t num_ops;
+	uint32_t weight;
+	uint64_t data_size;      /* bytes of requests after the header */
+};
+
+#define TRACEBIN_MAXVARINT  5  /* bytes in the longest 32-bit varint */
+
+/*
+ * tracebin_put - append "val" to "p" as a varint and return the address
+ *     after it
+ */
+static inline unsigned char *
+tracebin_put(unsigned char *p, uint32_t val)
+{
+	while (val >= 0x80) {
+		*p++ = (unsigned char)(val | 0x80);
+		val >>= 7;
+	}
+	*p++ = (unsigned char)val;
+	return p;
+}
+
+/*
+ * tracebin_get - decode a varint from "p", which must hold a whole one,
+ *     into "*val" and return the address after it
+ */
+static inline const unsigned char *
+tracebin_get(const unsigned char *p, uint32_t *val)
+{
+	uint32_t v = *p & 0x7f;
+	int shift = 7;
+
+	while (*p++ & 0x80) {
+		v |= (uint32_t)(*p & 0x7f) << shift;
+		shift += 7;
+	}
+	*val = v;
+	return p;
+}
+
+/*
+ * tracebin_check - like tracebin_get, but for a varint that must end
+ *     before "end" and fit in 32 bits.  Returns NULL if it does not.
+ */
+static inline const unsigned char *
+tracebin_check(const unsigned char *p, const unsigned char *end,
+    uint32_t *val)
+{
+	uint64_t v = 0;
+	int shift;
+
+	for (shift = 0; p < end && shift < 7 * TRACEBIN_MAXVARINT; shift += 7) {
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			if (v > UINT32_MAX)
+				return NULL;
+			*val = (uint32_t)v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * tracebin_scan_uint - parse an unsigned decimal number at *pp, after any
+ *     blanks, and advance *pp past it.  Returns 0 if there is no number
+ *     there (a sign is not part of one) or it does not fit in an unsigned.
+ */
+static inline int
+tracebin_scan_uint(const char **pp, const char *end, unsigned *val)
+{
+	const char *p = *pp;
+	unsigned long v = 0;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	if (p == end || *p < '0' || *p > '9')
+		return 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		if ((v = v * 10 + (*p - '0')) > UINT_MAX)
+			return 0;
+	*pp = p;
+	*val = (unsigned)v;
+	return 1;
+}
+
+/*
+ * tracebin_parse_line - parse the text request starting at *pp, the first
+ *     character of a line that is not blank, into its type (a
+ *     tracebin_type), id, and size (0 for a free), and advance *pp to the
+ *     end of the line.  Ids must be below "num_ids" and sizes at most
+ *     INT_MAX.  Returns NULL, or what is wrong with the line.
+ */
+static inline const char *
+tracebin_parse_line(const char **pp, const char *end, unsigned num_ids,
+    unsigned *type, unsigned *index, unsigned *size)
+{
+	const char *p = *pp;
+	char c;
+
+	/* A request is a type character, an id, and for a or r a size */
+	c = *p++;
+	if (c != 'a' && c != 'r' && c != 'f')
+		return "bogus type character";
+	if (!tracebin_scan_uint(&p, end, index) || *index >= num_ids)
+		return "missing or out-of-range id";
+	*size = 0;
+	if (c != 'f' && (!tracebin_scan_uint(&p, end, size) || *size > INT_MAX))
+		return "missing or out-of-range size";
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	if (p < end && *p != '\n')
+		return "junk at end of line";
+	*type = (c == 'a') ? TB_ALLOC : (c == 'r') ? TB_REALLOC : TB_FREE;
+	*pp = p;
+	return NULL;
+}
+
+/* Zigzag encoding maps small differences of either sign to small values. */
+#define TRACEBIN_ZIGZAG(d)    (((uint32_t)(d) << 1) ^ (uint32_t)((int32_t)(d) >> 31))
+#define TRACEBIN_UNZIGZAG(z)  ((int32_t)((z) >> 1) ^ -(int32_t)((z) & 1))
+
+#endif /* __TRACEBIN_H_ */